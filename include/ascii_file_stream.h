@@ -1,15 +1,34 @@
 #pragma once
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#include "ascii_line_index.h"
 #include "graph_stream.h"
 
 class AsciiFileStream : public GraphStream {
  public:
-  AsciiFileStream(std::string file_name, bool has_type = true)
-      : file_name(file_name), has_type(has_type) {
+  /**
+   * Open an AsciiFileStream
+   * @param file_name       Name of the stream file
+   * @param has_type        If true, every update line begins with its type.
+   * @param format_threads  Number of threads used to format written updates as text. Written
+   *                        updates are buffered and formatted in large batches, with this many
+   *                        threads each formatting a disjoint chunk of the batch.
+   */
+  AsciiFileStream(std::string file_name, bool has_type = true, size_t format_threads = 1)
+      : file_name(file_name), has_type(has_type),
+        format_threads(format_threads == 0 ? 1 : format_threads) {
 
     bool stream_exists = false;
     {
@@ -27,10 +46,40 @@ class AsciiFileStream : public GraphStream {
 
     if (stream_exists)
       stream_file >> num_vertices >> num_edges;
+
+    pending.reserve(pending_capacity);
+  }
+
+  ~AsciiFileStream() {
+    try {
+      close();
+    } catch (...) {
+      // errors are only reported by an explicit close()
+    }
+  }
+
+  // write all buffered updates, stop the formatting threads and close the file, reporting any
+  // write error. The stream must not be used afterwards.
+  inline void close() {
+    if (!stream_file.is_open()) return;
+    try {
+      flush_updates();
+    } catch (...) {
+      stop_formatters();
+      stream_file.close();
+      throw;
+    }
+    stop_formatters();
+    stream_file.flush();
+    bool failed = stream_file.bad();
+    stream_file.close();
+    if (failed || stream_file.fail())
+      throw StreamException("AsciiFileStream: could not write " + file_name);
   }
 
   inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates) {
     assert(upd_buf != nullptr);
+    flush_updates();
 
     size_t i = 0;
     for (; i < num_updates; i++) {
@@ -55,30 +104,95 @@ class AsciiFileStream : public GraphStream {
   inline bool get_update_is_thread_safe() { return false; }
 
   inline void write_header(node_id_t num_verts, edge_id_t num_edg) {
+    flush_updates();
+    line_index.reset();
     stream_file.seekp(0); // seek to beginning
     stream_file << num_verts << " " << num_edg << std::endl;
     num_vertices = num_verts;
     num_edges = num_edg;
   }
 
+  // updates are buffered and written as text in large batches. See flush_updates()
   inline void write_updates(GraphStreamUpdate* upd_buf, edge_id_t num_updates) {
     for (edge_id_t i = 0; i < num_updates; i++) {
-      auto upd = upd_buf[i];
-      if (has_type)
-        stream_file << (int) upd.type << " ";
-      stream_file << upd.edge.src << " " << upd.edge.dst << std::endl;
+      pending.push_back(upd_buf[i]);
+      if (pending.size() >= pending_capacity) flush_updates();
     }
   }
 
+  // format all buffered updates and write them to the file
+  inline void flush_updates() {
+    if (pending.empty()) return;
+    line_index.reset();  // the file changes, a cached index becomes stale
+
+    num_chunks = std::min(format_threads, (pending.size() + min_chunk - 1) / min_chunk);
+    chunk_size = (pending.size() + num_chunks - 1) / num_chunks;
+    format_bufs.resize(num_chunks);
+    chunk_bytes.resize(num_chunks);
+
+    // the calling thread formats the first chunk and the formatting threads the others
+    if (num_chunks > 1) {
+      start_formatters();
+      std::unique_lock<std::mutex> lk(format_lock);
+      ++batch;
+      formatters_busy = formatters.size();
+      batch_ready.notify_all();
+      lk.unlock();
+
+      std::exception_ptr error;
+      try {
+        format_chunk(0);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lk.lock();
+      batch_done.wait(lk, [&]() { return formatters_busy == 0; });
+      if (!error) error = format_error;
+      format_error = nullptr;
+      if (error) std::rethrow_exception(error);
+    } else {
+      format_chunk(0);
+    }
+
+    // write the chunks in order
+    for (size_t c = 0; c < num_chunks; c++)
+      stream_file.write(format_bufs[c].data(), chunk_bytes[c]);
+    pending.clear();
+  }
+
   inline void set_num_edges(edge_id_t num_edg) {
     num_edges = num_edg;
   }
 
+  // seek to a position in the stream. Seeking far into the stream uses the sidecar
+  // AsciiLineIndex of the file, which is built on first use.
   inline void seek(edge_id_t pos) {
-    if (pos != 0)
-      throw StreamException("AsciiFileStream: stream does not support seeking by update index");
-    stream_file.seekp(0); stream_file.seekg(0);
-    upd_offset = 0;
+    flush_updates();
+    stream_file.flush();
+    stream_file.clear();
+
+    size_t skip = pos;
+    if (pos >= AsciiLineIndex::default_stride) {
+      if (!line_index) line_index.reset(new AsciiLineIndex(file_name));
+      stream_file.seekg(line_index->locate(pos, skip));
+    } else {
+      // skip past the header line
+      node_id_t verts;
+      edge_id_t edges;
+      stream_file.seekg(0);
+      if (stream_file >> verts >> edges)
+        stream_file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      stream_file.clear();
+    }
+
+    // blank lines are not updates, as in AsciiLineIndex and the >> reader
+    for (size_t i = 0; i < skip; i++) {
+      stream_file >> std::ws;
+      stream_file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    stream_file.clear();  // reaching the end of the file is not an error
+    stream_file.seekp(stream_file.tellg());
+    upd_offset = pos;
   }
 
   inline bool set_break_point(edge_id_t break_idx) {
@@ -103,4 +217,111 @@ class AsciiFileStream : public GraphStream {
   std::fstream stream_file;
   edge_id_t break_edge_idx = -1;
   edge_id_t upd_offset = 0;
+  std::unique_ptr<AsciiLineIndex> line_index;  // built on the first seek past update 0
+
+  // write buffering
+  const size_t format_threads;
+  std::vector<GraphStreamUpdate> pending;   // updates written but not yet formatted
+  std::vector<std::vector<char>> format_bufs;  // one text buffer per formatting chunk
+  std::vector<size_t> chunk_bytes;             // length of the text in each buffer
+  size_t num_chunks = 0;
+  size_t chunk_size = 0;
+  static constexpr size_t pending_capacity = 1 << 20;
+  static constexpr size_t min_chunk = 1 << 16;  // fewest updates worth giving to a thread
+  static constexpr size_t max_line_size = 48;   // "type src dst\n" with 64 bit integers
+
+  // format_threads - 1 threads, started on the first flush that needs them, format chunk t + 1
+  // of every batch. They live until the stream is closed.
+  std::vector<std::thread> formatters;
+  std::mutex format_lock;  // protects the batch state below
+  std::condition_variable batch_ready;
+  std::condition_variable batch_done;
+  size_t batch = 0;            // number of batches handed to the formatting threads
+  size_t formatters_busy = 0;  // threads still formatting the current batch
+  bool stop_formatting = false;
+  std::exception_ptr format_error;
+
+  // format the updates of chunk c of the pending updates into its buffer
+  void format_chunk(size_t c) {
+    size_t begin = c * chunk_size;
+    size_t end = std::min(pending.size(), begin + chunk_size);
+    format_bufs[c].resize((end - begin) * max_line_size);
+    char* out = format_bufs[c].data();
+    for (size_t i = begin; i < end; i++) {
+      if (has_type) {
+        out = format_uint(pending[i].type, out);
+        *out++ = ' ';
+      }
+      out = format_uint(pending[i].edge.src, out);
+      *out++ = ' ';
+      out = format_uint(pending[i].edge.dst, out);
+      *out++ = '\n';
+    }
+    chunk_bytes[c] = out - format_bufs[c].data();
+  }
+
+  void start_formatters() {
+    while (formatters.size() < format_threads - 1) {
+      size_t t = formatters.size();
+      formatters.emplace_back(&AsciiFileStream::format_worker, this, t, batch);
+    }
+  }
+
+  // seen is the number of batches handed out before the thread was started
+  void format_worker(size_t t, size_t seen) {
+    std::unique_lock<std::mutex> lk(format_lock);
+    while (true) {
+      batch_ready.wait(lk, [&]() { return batch != seen || stop_formatting; });
+      if (stop_formatting) return;
+      seen = batch;
+
+      // the chunk is owned by this thread until it reports the batch done
+      lk.unlock();
+      std::exception_ptr error;
+      try {
+        if (t + 1 < num_chunks) format_chunk(t + 1);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lk.lock();
+      if (error && !format_error) format_error = error;
+      if (--formatters_busy == 0) batch_done.notify_one();
+    }
+  }
+
+  void stop_formatters() {
+    {
+      std::lock_guard<std::mutex> lk(format_lock);
+      stop_formatting = true;
+    }
+    batch_ready.notify_all();
+    for (auto& thr : formatters) thr.join();
+    formatters.clear();
+  }
+
+  // write the decimal representation of value to out, returns the end of the written text
+  static inline char* format_uint(uint64_t value, char* out) {
+    static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char digits[20];
+    char* pos = digits + sizeof(digits);
+    while (value >= 100) {
+      const char* pair = digit_pairs + (value % 100) * 2;
+      value /= 100;
+      *--pos = pair[1];
+      *--pos = pair[0];
+    }
+    if (value >= 10) {
+      const char* pair = digit_pairs + value * 2;
+      *--pos = pair[1];
+      *--pos = pair[0];
+    } else {
+      *--pos = char('0' + value);
+    }
+    size_t len = digits + sizeof(digits) - pos;
+    memcpy(out, pos, len);
+    return out + len;
+  }
 };
@@ -0,0 +1,144 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>  //open and close
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "graph_stream.h"
+
+// Sidecar index over an ascii stream file that allows seeking by update index.
+//
+// The index records the byte offset of the line holding every stride-th update. It is built in a
+// single memchr() pass over a mapping of the file and persisted next to it as <file_name>.idx.
+// The persisted index is reused as long as the stride, size and modification time of the stream
+// file match, otherwise it is rebuilt. Failing to persist the index is not an error.
+//
+// Seeking to update i jumps to the offset of update (i / stride) * stride and then skips the
+// remaining (i % stride) update lines. Blank lines are not counted.
+class AsciiLineIndex {
+ public:
+  static constexpr size_t default_stride = 1 << 16;
+
+  /**
+   * Load the index of an ascii stream file, building and persisting it if necessary
+   * @param file_name  Name of the ascii stream file. All written data must be flushed.
+   * @param stride     Number of updates between indexed offsets.
+   */
+  AsciiLineIndex(std::string file_name, size_t stride = default_stride)
+      : stride(stride == 0 ? 1 : stride) {
+    struct stat file_stat;
+    if (stat(file_name.c_str(), &file_stat) == -1)
+      throw StreamException("AsciiLineIndex: could not stat " + file_name);
+    file_size = file_stat.st_size;
+    file_mtime = uint64_t(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+
+    std::string idx_file = index_file_name(file_name);
+    if (!load(idx_file)) {
+      build(file_name);
+      persist(idx_file);
+    }
+  }
+
+  static std::string index_file_name(std::string file_name) { return file_name + ".idx"; }
+
+  // returns the start of the first line at or after pos that is not blank, or end. Blank lines
+  // hold only spaces, tabs and carriage returns and are skipped by readers, as std::fstream's >>
+  // skips them, so they do not count as updates. pos must be at the start of a line.
+  static const char* skip_blank_lines(const char* pos, const char* end) {
+    const char* line = pos;
+    for (; pos < end; ++pos) {
+      if (*pos == '\n')
+        line = pos + 1;
+      else if (*pos != ' ' && *pos != '\t' && *pos != '\r')
+        return line;
+    }
+    return end;
+  }
+
+  // does the file hold the indexed line at or before update edge_idx, so locate() succeeds
+  bool covers(edge_id_t edge_idx) const { return edge_idx / stride < offsets.size(); }
+
+  /**
+   * Find the position of an update within the stream file
+   * @param edge_idx  The index of the update.
+   * @param skip      Set to the number of lines to skip, from the returned offset, to reach the
+   *                  line of the update.
+   * @return          A byte offset at the start of a line.
+   */
+  size_t locate(edge_id_t edge_idx, size_t& skip) const {
+    size_t entry = edge_idx / stride;
+    if (entry >= offsets.size())
+      throw StreamException("AsciiLineIndex: update index is past the end of the stream");
+    skip = edge_idx % stride;
+    return offsets[entry];
+  }
+
+ private:
+  uint64_t stride;
+  uint64_t file_size;
+  uint64_t file_mtime;
+  std::vector<uint64_t> offsets;  // byte offset of the line of update i * stride
+
+  // load a persisted index, returns false if there is none or it does not match the file
+  bool load(std::string idx_file) {
+    std::ifstream in(idx_file, std::ios::binary);
+    if (!in.is_open()) return false;
+
+    uint64_t header[4];  // stride, file size, file mtime, number of offsets
+    if (!in.read((char*)header, sizeof(header))) return false;
+    if (header[0] != stride || header[1] != file_size || header[2] != file_mtime) return false;
+
+    offsets.resize(header[3]);
+    if (!in.read((char*)offsets.data(), offsets.size() * sizeof(uint64_t))) {
+      offsets.clear();
+      return false;
+    }
+    return true;
+  }
+
+  // best effort, the stream may live in a read only directory
+  void persist(std::string idx_file) {
+    std::ofstream out(idx_file, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return;
+    uint64_t header[4] = {stride, file_size, file_mtime, offsets.size()};
+    out.write((char*)header, sizeof(header));
+    out.write((char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+    if (!out) std::remove(idx_file.c_str());
+  }
+
+  void build(std::string file_name) {
+    offsets.clear();
+    if (file_size == 0) throw StreamException("AsciiLineIndex: stream file is empty");
+
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd == -1) throw StreamException("AsciiLineIndex: could not open " + file_name);
+    void* addr = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) throw StreamException("AsciiLineIndex: could not map " + file_name);
+    madvise(addr, file_size, MADV_SEQUENTIAL);
+
+    const char* begin = static_cast<const char*>(addr);
+    const char* end = begin + file_size;
+    auto next_line = [&](const char* pos) {
+      const char* newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+      return newline == nullptr ? end : newline + 1;
+    };
+
+    // skip the header line, then record the offset of every stride-th update line. The end of the
+    // file is recorded as well if it falls on a stride boundary, so seeking to the end works.
+    const char* pos = skip_blank_lines(next_line(skip_blank_lines(begin, end)), end);
+    size_t line = 0;
+    for (; pos < end; ++line) {
+      if (line % stride == 0) offsets.push_back(pos - begin);
+      pos = skip_blank_lines(next_line(pos), end);
+    }
+    if (line % stride == 0) offsets.push_back(file_size);
+
+    munmap(addr, file_size);
+  }
+};
@@ -1,76 +1,125 @@
 #pragma once
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>  //open and close
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include "graph_stream.h"
+#include "update_encoding.h"
 
-class BinaryFileStream : public GraphStream {
+// A stream of fixed size binary update records following a header of the number of vertices and
+// edges. The Encoding (see update_encoding.h) selects the record format at compile time. Use the
+// BinaryFileStream or CompactBinaryFileStream typedefs below.
+//
+// With direct_io the file is opened with O_DIRECT so that reads and writes bypass the page cache.
+// All I/O then goes through 4 KiB aligned staging buffers taken from a pool, and blocks that are
+// only partly covered by a write, such as the one holding the header, are read, modified and
+// written back. The file may be padded to a whole block while it is written and is truncated to
+// its length when the stream is destroyed.
+template <typename Encoding>
+class BasicBinaryFileStream : public GraphStream {
  public:
   /**
    * Open a BinaryFileStream
    * @param file_name       Name of the stream file
    * @param open_read_only  If true, indicates that we are only going to read this stream. Write
    *                        operations will fail. If false, we may both read and write.
+   * @param direct_io       If true, open the file with O_DIRECT to bypass the page cache.
    */
-  BinaryFileStream(std::string file_name, bool open_read_only = true)
-      : read_only(open_read_only), file_name(file_name) {
-    if (read_only)
-      stream_fd = open(file_name.c_str(), O_RDONLY, S_IRUSR);
-    else
-      stream_fd = open(file_name.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  BasicBinaryFileStream(std::string file_name, bool open_read_only = true,
+                        bool direct_io = false)
+      : read_only(open_read_only), file_name(file_name), direct_io(direct_io) {
+    int flags = read_only ? O_RDONLY : O_RDWR | O_CREAT;
+#ifdef O_DIRECT
+    if (direct_io) flags |= O_DIRECT;
+#else
+    if (direct_io) throw StreamException("BinaryFileStream: O_DIRECT is not supported");
+#endif
+    stream_fd = open(file_name.c_str(), flags, S_IRUSR | S_IWUSR);
 
-    if (!stream_fd)
-      throw StreamException("BinaryFileStream: Could not open stream file " + file_name +
-                            ". Does it exist?");
+    if (stream_fd == -1)
+      throw StreamException("BinaryFileStream: Could not open stream file " + file_name + ": " +
+                            strerror(errno));
+
+    if (direct_io) {
+      struct stat file_stat;
+      if (fstat(stream_fd, &file_stat) == -1) {
+        close(stream_fd);
+        throw StreamException("BinaryFileStream: Could not stat stream file " + file_name);
+      }
+      file_size = file_stat.st_size;
+    }
 
     // read header from the input file
-    if (read(stream_fd, (char*)&num_vertices, sizeof(num_vertices)) != sizeof(num_vertices) &&
+    if (read_at((char*)&num_vertices, sizeof(num_vertices), 0) != sizeof(num_vertices) &&
         open_read_only)
       throw StreamException("BinaryFileStream: Could not read number of nodes");
-    if (read(stream_fd, (char*)&num_edges, sizeof(num_edges)) != sizeof(num_edges) &&
+    if (read_at((char*)&num_edges, sizeof(num_edges), sizeof(num_vertices)) !=
+            sizeof(num_edges) &&
         open_read_only)
       throw StreamException("BinaryFileStream: Could not read number of edges");
 
     end_of_file = (num_edges * edge_size) + header_size;
     stream_off = header_size;
+    write_off = header_size;
     set_break_point(-1);
   }
 
-  ~BinaryFileStream() {
-    if (stream_fd) close(stream_fd);
+  ~BasicBinaryFileStream() {
+    // remove the padding of the last block written in direct mode
+    if (direct_io && !read_only) {
+      if (ftruncate(stream_fd, file_size) == -1) perror("BinaryFileStream: ftruncate");
+    }
+    close(stream_fd);
+    for (char* buf : staging_pool) free(buf);
   }
 
   inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates) {
     assert(upd_buf != nullptr);
 
-    // many threads may execute this line simultaneously creating edge cases
-    size_t bytes_to_read = num_updates * edge_size;
-    size_t read_off = stream_off.fetch_add(bytes_to_read, std::memory_order_relaxed);
-
-    // catch these edge cases here
-    if (read_off + bytes_to_read > break_index) {
-      bytes_to_read = read_off > break_index ? 0 : break_index - read_off;
-      stream_off = break_index.load();
-      upd_buf[bytes_to_read / edge_size] = {BREAKPOINT, {0, 0}};
-    }
-    // read into the buffer
-    assert(bytes_to_read % edge_size == 0);
-    size_t bytes_read = 0;
-    while (bytes_read < bytes_to_read) {
-      int r =
-          pread(stream_fd, upd_buf + bytes_read, bytes_to_read - bytes_read, read_off + bytes_read);
-      if (r == -1) throw StreamException("BinaryFileStream: Could not perform pread");
-      if (r == 0) throw StreamException("BinaryFileStream: pread() got no data");
-      bytes_read += r;
+    size_t upds_read = 0;
+    if (lease_bytes == 0) {
+      size_t bytes_claimed;
+      size_t read_off = claim(num_updates * edge_size, bytes_claimed);
+      upds_read = bytes_claimed / edge_size;
+      read_decoded(upd_buf, upds_read, read_off);
+    } else {
+      // serve the request from the lease of this thread, claiming new leases as they run out
+      Lease& lease = thread_lease();
+      while (upds_read < num_updates) {
+        size_t next = lease.next.load(std::memory_order_relaxed);
+        size_t end = std::min(lease.end.load(std::memory_order_relaxed),
+                              size_t(break_index.load(std::memory_order_relaxed)));
+        if (next >= end) {
+          // the rest of a lease past a lowered break point is kept for later
+          size_t bytes_claimed;
+          size_t claimed = claim(lease_bytes, bytes_claimed);
+          if (bytes_claimed == 0) break;
+          next = claimed;
+          end = claimed + bytes_claimed;
+          lease.next.store(next, std::memory_order_relaxed);
+          lease.end.store(end, std::memory_order_relaxed);
+        }
+        size_t upds = std::min(num_updates - upds_read, (end - next) / edge_size);
+        read_decoded(upd_buf + upds_read, upds, next);
+        lease.next.store(next + upds * edge_size, std::memory_order_relaxed);
+        upds_read += upds;
+      }
     }
 
-    size_t upds_read = bytes_to_read / edge_size;
     if (upds_read < num_updates) {
       GraphStreamUpdate& upd = upd_buf[upds_read];
       upd.type = BREAKPOINT;
@@ -80,50 +129,83 @@ class BinaryFileStream : public GraphStream {
     return upds_read;
   }
 
+  /*
+   * Lease updates to reading threads in chunks. Each thread claims num_updates updates at a time
+   * with a single atomic operation and serves its get_update_buffer() calls from its lease, so
+   * threads reading small batches rarely touch the shared read offset. A thread receives the
+   * BREAKPOINT once its lease and the stream before the break point are exhausted, and no lease
+   * extends past the break point. A break point may be set at any update not yet read from a
+   * lease, and a thread keeps the rest of its lease past a lowered break point. Threads must read
+   * until they receive the BREAKPOINT: updates left in the lease of a thread that stops early are
+   * not handed to other threads. 0, the default, disables leasing. Must not be called while
+   * other threads read.
+   */
+  inline void set_lease_size(size_t num_updates) {
+    lease_bytes = num_updates * edge_size;
+    ++lease_epoch;
+  }
+
+  // read updates at an explicit update index, independent of the read position and break point.
+  // Thread safe. Returns the number of updates read, which is less than num_updates only at the
+  // end of the stream. No BREAKPOINT is added.
+  inline size_t read_updates_at(GraphStreamUpdate* upd_buf, edge_id_t num_updates,
+                                edge_id_t edge_idx) {
+    if (edge_idx >= num_edges) return 0;
+    num_updates = std::min(num_updates, num_edges - edge_idx);
+    read_decoded(upd_buf, num_updates, header_size + edge_idx * edge_size);
+    return num_updates;
+  }
+
   // get_update_buffer() is thread safe! :)
   inline bool get_update_is_thread_safe() { return true; }
 
   // write the number of nodes and edges to the stream
   inline void write_header(node_id_t num_verts, edge_id_t num_edg) {
     if (read_only) throw StreamException("BinaryFileStream: stream not open for writing!");
+    Encoding::check_vertices(num_verts);
 
-    lseek(stream_fd, 0, SEEK_SET);
-    int r1 = write(stream_fd, (char*)&num_verts, sizeof(num_verts));
-    int r2 = write(stream_fd, (char*)&num_edg, sizeof(num_edg));
-
-    if (r1 + r2 != header_size) {
-      perror("write_header");
-      throw StreamException("BinaryFileStream: could not write header to stream file");
-    }
+    char header[header_size];
+    memcpy(header, &num_verts, sizeof(num_verts));
+    memcpy(header + sizeof(num_verts), &num_edg, sizeof(num_edg));
+    write_records(header, header_size, 0);
 
     stream_off = header_size;
+    write_off = header_size;
     num_vertices = num_verts;
     num_edges = num_edg;
     end_of_file = (num_edges * edge_size) + header_size;
   }
 
-  // write an edge to the stream
+  // write updates after those written before. Thread safe, each call reserves its range of the
+  // stream with an atomic, so the updates of one call stay together but concurrent calls are
+  // written in no particular order.
   inline void write_updates(GraphStreamUpdate* upd, edge_id_t num_updates) {
     if (read_only) throw StreamException("BinaryFileStream: stream not open for writing!");
+    size_t offset = write_off.fetch_add(num_updates * edge_size, std::memory_order_relaxed);
+    write_encoded(upd, num_updates, offset);
+  }
 
-    size_t bytes_to_write = num_updates * edge_size;
-    // size_t write_off = stream_off.fetch_add(bytes_to_write, std::memory_order_relaxed);
+  // reserve the next num_updates updates of the stream for the caller, who fills them with
+  // write_updates_at(). Returns the update index of the first reserved update. Thread safe.
+  inline edge_id_t reserve_updates(edge_id_t num_updates) {
+    if (read_only) throw StreamException("BinaryFileStream: stream not open for writing!");
+    size_t offset = write_off.fetch_add(num_updates * edge_size, std::memory_order_relaxed);
+    return (offset - header_size) / edge_size;
+  }
 
-    size_t bytes_written = 0;
-    while (bytes_written < bytes_to_write) {
-      int r = write(stream_fd, (char*)upd + bytes_written, bytes_to_write - bytes_written);
-      if (r == -1) throw StreamException("BinaryFileStream: Could not perform write");
-      bytes_written += r;
-    }
+  // write updates at an explicit update index, independent of the file position.
+  // Thread safe, many threads may write disjoint ranges of the stream at once.
+  inline void write_updates_at(GraphStreamUpdate* upd, edge_id_t num_updates,
+                               edge_id_t edge_idx) {
+    if (read_only) throw StreamException("BinaryFileStream: stream not open for writing!");
+    write_encoded(upd, num_updates, header_size + edge_idx * edge_size);
   }
 
-  // seek to a position in the stream
+  // seek to a position in the stream, for both reads and writes. Outstanding leases are dropped.
   inline void seek(edge_id_t edge_idx) {
+    ++lease_epoch;
     stream_off = edge_idx * edge_size + header_size;
-    if (lseek(stream_fd, stream_off, SEEK_SET) == -1) {
-      perror("BinaryFileStream::write_updates");
-      throw StreamException("BinaryFileStream: Could not perform seek");
-    }
+    write_off = edge_idx * edge_size + header_size;
   }
 
   inline bool set_break_point(edge_id_t break_idx) {
@@ -131,20 +213,20 @@ class BinaryFileStream : public GraphStream {
     if (break_idx != END_OF_STREAM) {
       byte_index = header_size + break_idx * edge_size;
     }
-    if (byte_index < stream_off) return false;
+    if (!unread_from(byte_index)) return false;
     break_index = byte_index;
     if (break_index > end_of_file) break_index = end_of_file;
     return true;
   }
 
   inline void serialize_metadata(std::ostream& out) {
-    out << BinaryFile << " " << file_name << std::endl;
+    out << Encoding::binary_stream_type << " " << file_name << std::endl;
   }
 
   static GraphStream* construct_from_metadata(std::istream& in) {
     std::string file_name_from_stream;
     in >> file_name_from_stream;
-    return new BinaryFileStream(file_name_from_stream);
+    return new BasicBinaryFileStream(file_name_from_stream);
   }
 
  private:
@@ -152,10 +234,268 @@ class BinaryFileStream : public GraphStream {
   edge_id_t end_of_file;
   std::atomic<edge_id_t> stream_off;
   std::atomic<edge_id_t> break_index;
+  std::atomic<edge_id_t> write_off;  // where write_updates() writes next
   const bool read_only;  // is stream read only?
   const std::string file_name;
 
+  // direct I/O. Blocks partly covered by a write are updated under the lock so that writers of
+  // neighbouring ranges do not overwrite each other. file_size is the length the file is
+  // truncated to, excluding the padding of the last block.
+  const bool direct_io;
+  std::atomic<size_t> file_size{0};
+  std::mutex partial_block_lock;
+  std::mutex staging_lock;
+  std::vector<char*> staging_pool;  // free staging buffers
+
+  // A range of the stream claimed by a thread. Leases of an older epoch are void. A lease is only
+  // changed by its thread, but read by set_break_point().
+  struct Lease {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<size_t> next{0};  // byte offsets
+    std::atomic<size_t> end{0};
+  };
+  size_t lease_bytes = 0;
+  std::atomic<uint64_t> lease_epoch{1};
+  const uint64_t stream_id = new_stream_id();
+  std::mutex lease_lock;
+  std::unordered_map<std::thread::id, std::unique_ptr<Lease>> leases;  // of the reading threads
+
+  static constexpr size_t lease_cache_size = 4;
+
+  static uint64_t new_stream_id() {
+    static std::atomic<uint64_t> next_id{0};
+    return next_id++;
+  }
+
+  // the lease of the calling thread for this stream. Leases belong to the stream, each thread
+  // caches where its leases of the last few streams it read are. Stream ids are never reused, so
+  // entries for destroyed streams are never matched and are replaced in turn.
+  inline Lease& thread_lease() {
+    struct CacheEntry {
+      uint64_t stream_id = uint64_t(-1);
+      Lease* lease = nullptr;
+    };
+    static thread_local CacheEntry cache[lease_cache_size];
+    static thread_local size_t next_victim = 0;
+
+    Lease* lease = nullptr;
+    for (auto& entry : cache)
+      if (entry.stream_id == stream_id) lease = entry.lease;
+    if (lease == nullptr) {
+      {
+        std::lock_guard<std::mutex> lk(lease_lock);
+        std::unique_ptr<Lease>& owned = leases[std::this_thread::get_id()];
+        if (!owned) owned.reset(new Lease());
+        lease = owned.get();
+      }
+      cache[next_victim] = {stream_id, lease};
+      next_victim = (next_victim + 1) % lease_cache_size;
+    }
+
+    uint64_t epoch = lease_epoch.load();
+    if (lease->epoch.load(std::memory_order_relaxed) != epoch) {
+      lease->next.store(0, std::memory_order_relaxed);
+      lease->end.store(0, std::memory_order_relaxed);
+      lease->epoch.store(epoch, std::memory_order_relaxed);
+    }
+    return *lease;
+  }
+
+  // have none of the updates from a byte offset onwards been read yet, from the stream or from a
+  // lease. The parts of the leases not read yet must then cover the stream up to the read offset.
+  inline bool unread_from(size_t offset) {
+    size_t covered = stream_off;
+    if (offset >= covered) return true;
+    if (lease_bytes == 0) return false;
+
+    std::vector<std::pair<size_t, size_t>> unread;  // end and next of leases, disjoint
+    uint64_t epoch = lease_epoch.load();
+    {
+      std::lock_guard<std::mutex> lk(lease_lock);
+      for (auto& entry : leases) {
+        Lease& lease = *entry.second;
+        size_t next = lease.next.load(std::memory_order_relaxed);
+        size_t end = lease.end.load(std::memory_order_relaxed);
+        if (lease.epoch.load(std::memory_order_relaxed) == epoch && next < end)
+          unread.push_back({end, next});
+      }
+    }
+    std::sort(unread.rbegin(), unread.rend());
+    for (auto& range : unread) {
+      if (range.first < covered) break;
+      covered = std::min(covered, range.second);
+    }
+    return offset >= covered;
+  }
+
+  // claim up to bytes of the stream before the break point. Returns the offset of the claim and
+  // sets bytes_claimed, which is 0 once the break point is reached. The read offset never passes
+  // the break point, so set_break_point() can tell from it and the leases whether an update was
+  // already handed out.
+  inline size_t claim(size_t bytes, size_t& bytes_claimed) {
+    size_t off = stream_off.load(std::memory_order_relaxed);
+    do {
+      size_t limit = break_index.load(std::memory_order_relaxed);
+      bytes_claimed = off >= limit ? 0 : std::min(bytes, limit - off);
+      if (bytes_claimed == 0) return off;
+    } while (!stream_off.compare_exchange_weak(off, off + bytes_claimed,
+                                               std::memory_order_relaxed));
+    return off;
+  }
+
+  // read and decode updates from a byte offset. Records smaller than a GraphStreamUpdate are read
+  // into the end of the buffer and decoded in place.
+  inline void read_decoded(GraphStreamUpdate* upd_buf, size_t num_updates, size_t read_off) {
+    size_t bytes_to_read = num_updates * edge_size;
+    char* read_buf = (char*)upd_buf + num_updates * (sizeof(GraphStreamUpdate) - edge_size);
+    if (read_at(read_buf, bytes_to_read, read_off) != bytes_to_read)
+      throw StreamException("BinaryFileStream: pread() got no data");
+    Encoding::decode_in_place(upd_buf, num_updates);
+  }
+
+  // encode and write updates at a byte offset
+  inline void write_encoded(GraphStreamUpdate* upd, edge_id_t num_updates, size_t offset) {
+    if (std::is_same<record_t, GraphStreamUpdate>::value) {
+      write_records((char*)upd, num_updates * edge_size, offset);
+      return;
+    }
+
+    // other encodings are encoded in batches on the stack
+    record_t records[encode_batch];
+    for (edge_id_t done = 0; done < num_updates; done += encode_batch) {
+      size_t batch = std::min(num_updates - done, edge_id_t(encode_batch));
+      Encoding::encode(upd + done, records, batch);
+      write_records((char*)records, batch * edge_size, offset + done * edge_size);
+    }
+  }
+
+  inline void write_records(const char* records, size_t bytes_to_write, size_t offset) {
+    if (direct_io) {
+      write_direct(records, bytes_to_write, offset);
+      return;
+    }
+    size_t bytes_written = 0;
+    while (bytes_written < bytes_to_write) {
+      int r = pwrite(stream_fd, records + bytes_written, bytes_to_write - bytes_written,
+                     offset + bytes_written);
+      if (r == -1) throw StreamException("BinaryFileStream: Could not perform write");
+      bytes_written += r;
+    }
+  }
+
+  // read up to bytes at offset. Returns the number of bytes read, less than bytes only at the end
+  // of the file.
+  inline size_t read_at(char* dst, size_t bytes, size_t offset) {
+    if (!direct_io) return pread_full(dst, bytes, offset);
+
+    StagingBuffer stage(*this);
+    size_t bytes_read = 0;
+    while (bytes_read < bytes) {
+      size_t block_off = align_down(offset + bytes_read);
+      size_t skip = offset + bytes_read - block_off;
+      size_t len = std::min(size_t(staging_size), align_up(skip + bytes - bytes_read));
+      size_t got = pread_full(stage.buf, len, block_off);
+      if (got <= skip) break;  // end of file
+      size_t use = std::min(bytes - bytes_read, got - skip);
+      memcpy(dst + bytes_read, stage.buf + skip, use);
+      bytes_read += use;
+    }
+    return bytes_read;
+  }
+
+  // write with O_DIRECT. Whole blocks are copied to a staging buffer and written, while the
+  // partly covered first and last blocks are read, modified and written under a lock.
+  inline void write_direct(const char* src, size_t bytes, size_t offset) {
+    if (bytes == 0) return;
+    size_t end = offset + bytes;
+    size_t inner_begin = align_up(offset);
+    size_t inner_end = std::max(align_down(end), inner_begin);
+
+    StagingBuffer stage(*this);
+    for (size_t off = inner_begin; off < inner_end; off += staging_size) {
+      size_t len = std::min(size_t(staging_size), inner_end - off);
+      memcpy(stage.buf, src + (off - offset), len);
+      pwrite_full(stage.buf, len, off);
+    }
+
+    if (offset < inner_begin) write_partial_block(stage.buf, src, offset, end, align_down(offset));
+    if (inner_end < end && align_down(end) >= inner_begin)
+      write_partial_block(stage.buf, src, offset, end, align_down(end));
+
+    size_t size = file_size.load();
+    while (size < end && !file_size.compare_exchange_weak(size, end)) continue;
+  }
+
+  // write the part of [begin, end) from src that falls in the block at block_off
+  inline void write_partial_block(char* block, const char* src, size_t begin, size_t end,
+                                  size_t block_off) {
+    std::lock_guard<std::mutex> lk(partial_block_lock);
+    size_t got = pread_full(block, direct_block, block_off);
+    memset(block + got, 0, direct_block - got);
+    size_t from = std::max(begin, block_off);
+    size_t to = std::min(end, block_off + direct_block);
+    memcpy(block + (from - block_off), src + (from - begin), to - from);
+    pwrite_full(block, direct_block, block_off);
+  }
+
+  inline size_t pread_full(char* dst, size_t bytes, size_t offset) {
+    size_t bytes_read = 0;
+    while (bytes_read < bytes) {
+      ssize_t r = pread(stream_fd, dst + bytes_read, bytes - bytes_read, offset + bytes_read);
+      if (r == -1 && errno == EINTR) continue;
+      if (r == -1) throw StreamException("BinaryFileStream: Could not perform pread");
+      if (r == 0) break;
+      bytes_read += r;
+      // a direct read ending off a block boundary reached the end of the file
+      if (direct_io && bytes_read % direct_block != 0) break;
+    }
+    return bytes_read;
+  }
+
+  inline void pwrite_full(const char* src, size_t bytes, size_t offset) {
+    size_t bytes_written = 0;
+    while (bytes_written < bytes) {
+      ssize_t r = pwrite(stream_fd, src + bytes_written, bytes - bytes_written,
+                         offset + bytes_written);
+      if (r == -1 && errno == EINTR) continue;
+      if (r == -1) throw StreamException("BinaryFileStream: Could not perform write");
+      bytes_written += r;
+    }
+  }
+
+  // An aligned staging buffer for direct I/O, borrowed from the pool for its lifetime
+  struct StagingBuffer {
+    BasicBinaryFileStream& stream;
+    char* buf;
+    StagingBuffer(BasicBinaryFileStream& stream) : stream(stream) {
+      std::lock_guard<std::mutex> lk(stream.staging_lock);
+      if (stream.staging_pool.empty()) {
+        void* mem;
+        if (posix_memalign(&mem, direct_block, staging_size) != 0)
+          throw StreamException("BinaryFileStream: Could not allocate staging buffer");
+        buf = (char*)mem;
+      } else {
+        buf = stream.staging_pool.back();
+        stream.staging_pool.pop_back();
+      }
+    }
+    ~StagingBuffer() {
+      std::lock_guard<std::mutex> lk(stream.staging_lock);
+      stream.staging_pool.push_back(buf);
+    }
+  };
+
+  static inline size_t align_down(size_t off) { return off & ~(size_t(direct_block) - 1); }
+  static inline size_t align_up(size_t off) { return align_down(off + direct_block - 1); }
+
   // size of binary encoded edge and buffer read size
-  static constexpr size_t edge_size = sizeof(GraphStreamUpdate);
+  typedef typename Encoding::record_t record_t;
+  static constexpr size_t edge_size = sizeof(record_t);
   static constexpr size_t header_size = sizeof(node_id_t) + sizeof(edge_id_t);
+  static constexpr size_t encode_batch = 4096;  // records encoded at once when writing
+  static constexpr size_t direct_block = 4096;  // alignment of direct I/O
+  static constexpr size_t staging_size = 1 << 20;  // bytes of a direct I/O staging buffer
 };
+
+typedef BasicBinaryFileStream<PackedUpdateEncoding> BinaryFileStream;
+typedef BasicBinaryFileStream<CompactUpdateEncoding> CompactBinaryFileStream;
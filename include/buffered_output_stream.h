@@ -0,0 +1,198 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "graph_stream.h"
+
+// A GraphStream decorator that writes behind the producer. Updates are copied into a pool of
+// num_buffers large buffers and a background I/O thread writes full buffers to the wrapped stream
+// in order, so the producer keeps generating while earlier updates are written. When every buffer
+// is full or being written the producer blocks until one is free.
+//
+// close() writes out all buffered updates and then finalizes the header of the wrapped stream
+// with the number of updates written through the decorator, so producers need not know the
+// length of the stream up front. The decorator is write only, and write_updates() must be called
+// by one thread at a time.
+class BufferedOutputStream : public GraphStream {
+ public:
+  /**
+   * Create a BufferedOutputStream
+   * @param stream       The stream to write to. Not owned, must outlive this object.
+   * @param buffer_size  The number of updates per buffer, written to the stream at once.
+   * @param num_buffers  The number of buffers in the pool.
+   */
+  BufferedOutputStream(GraphStream* stream, size_t buffer_size = 1 << 18, size_t num_buffers = 4)
+      : stream(stream), pool(num_buffers) {
+    if (buffer_size == 0 || num_buffers == 0)
+      throw StreamException("BufferedOutputStream: buffer_size and num_buffers must be > 0");
+
+    num_vertices = stream->vertices();
+    num_edges = stream->edges();
+    for (size_t b = 0; b < pool.size(); b++) {
+      pool[b].updates.resize(buffer_size);
+      free_buffers.push_back(b);
+    }
+    io_thread = std::thread(&BufferedOutputStream::write_behind, this);
+  }
+
+  ~BufferedOutputStream() {
+    try {
+      close();
+    } catch (...) {
+      // errors are only reported by an explicit close()
+    }
+  }
+
+  // write out all buffered updates and rewrite the header of the wrapped stream with the number
+  // of updates written. Further writes are not allowed.
+  inline void close() {
+    if (closed) return;
+    closed = true;
+    try {
+      flush();
+    } catch (...) {
+      stop_io_thread();
+      throw;
+    }
+    stop_io_thread();
+    stream->write_header(num_vertices, updates_written);
+    num_edges = updates_written;
+  }
+
+  // block until all buffered updates are written to the wrapped stream
+  inline void flush() {
+    std::unique_lock<std::mutex> lk(pool_lock);
+    if (cur_buffer != no_buffer && pool[cur_buffer].size > 0) {
+      full_buffers.push_back(cur_buffer);
+      cur_buffer = no_buffer;
+      buffer_full.notify_one();
+    }
+    buffer_free.wait(lk, [&]() { return (full_buffers.empty() && !writing) || io_error; });
+    if (io_error) std::rethrow_exception(io_error);
+  }
+
+  // writes the header to the wrapped stream once the buffered updates are written
+  inline void write_header(node_id_t num_verts, edge_id_t num_edg) {
+    if (closed) throw StreamException("BufferedOutputStream: stream is closed!");
+    flush();
+    stream->write_header(num_verts, num_edg);
+    num_vertices = num_verts;
+    num_edges = num_edg;
+  }
+
+  inline void write_updates(GraphStreamUpdate* upd, edge_id_t num_updates) {
+    if (closed) throw StreamException("BufferedOutputStream: stream is closed!");
+    while (num_updates > 0) {
+      if (cur_buffer == no_buffer) cur_buffer = acquire_buffer();
+
+      // the current buffer is owned by the producer until it is queued
+      Buffer& buffer = pool[cur_buffer];
+      size_t to_copy = std::min(size_t(num_updates), buffer.updates.size() - buffer.size);
+      memcpy(buffer.updates.data() + buffer.size, upd, to_copy * sizeof(GraphStreamUpdate));
+      buffer.size += to_copy;
+      upd += to_copy;
+      num_updates -= to_copy;
+      updates_written += to_copy;
+
+      if (buffer.size == buffer.updates.size()) {
+        std::lock_guard<std::mutex> lk(pool_lock);
+        full_buffers.push_back(cur_buffer);
+        cur_buffer = no_buffer;
+        buffer_full.notify_one();
+      }
+    }
+  }
+
+  // write out buffered updates before moving the write position of the wrapped stream
+  inline void seek(edge_id_t edge_idx) {
+    flush();
+    stream->seek(edge_idx);
+  }
+
+  // the decorator only writes
+  inline size_t get_update_buffer(GraphStreamUpdate*, edge_id_t) {
+    throw StreamException("BufferedOutputStream: stream is write only!");
+  }
+  inline bool get_update_is_thread_safe() { return false; }
+  inline bool set_break_point(edge_id_t) { return false; }
+
+  inline void serialize_metadata(std::ostream& out) { stream->serialize_metadata(out); }
+
+ private:
+  struct Buffer {
+    std::vector<GraphStreamUpdate> updates;
+    size_t size = 0;  // number of valid updates in the buffer
+  };
+
+  GraphStream* stream;
+  std::vector<Buffer> pool;
+  static constexpr size_t no_buffer = size_t(-1);
+  size_t cur_buffer = no_buffer;  // the buffer being filled by the producer
+  edge_id_t updates_written = 0;
+  bool closed = false;
+
+  // buffers are either free, filled by the producer, queued in full_buffers or being written
+  std::vector<size_t> free_buffers;
+  std::deque<size_t> full_buffers;
+  std::mutex pool_lock;
+  std::condition_variable buffer_full;
+  std::condition_variable buffer_free;
+
+  std::thread io_thread;
+  bool stop_io = false;
+  bool writing = false;  // the I/O thread is writing a buffer
+  std::exception_ptr io_error;
+
+  size_t acquire_buffer() {
+    std::unique_lock<std::mutex> lk(pool_lock);
+    buffer_free.wait(lk, [&]() { return !free_buffers.empty() || io_error; });
+    if (io_error) std::rethrow_exception(io_error);
+    size_t b = free_buffers.back();
+    free_buffers.pop_back();
+    pool[b].size = 0;
+    return b;
+  }
+
+  void write_behind() {
+    std::unique_lock<std::mutex> lk(pool_lock);
+    while (true) {
+      buffer_full.wait(lk, [&]() { return !full_buffers.empty() || stop_io; });
+      if (full_buffers.empty()) return;  // stopped with nothing left to write
+      size_t b = full_buffers.front();
+      full_buffers.pop_front();
+      writing = true;
+
+      // the queued buffer is owned by the I/O thread, so write without the lock
+      lk.unlock();
+      try {
+        stream->write_updates(pool[b].updates.data(), pool[b].size);
+      } catch (...) {
+        lk.lock();
+        io_error = std::current_exception();
+        writing = false;
+        buffer_free.notify_all();
+        return;
+      }
+      lk.lock();
+      writing = false;
+      free_buffers.push_back(b);
+      buffer_free.notify_all();
+    }
+  }
+
+  void stop_io_thread() {
+    {
+      std::lock_guard<std::mutex> lk(pool_lock);
+      stop_io = true;
+    }
+    buffer_full.notify_all();
+    if (io_thread.joinable()) io_thread.join();
+  }
+};
@@ -0,0 +1,326 @@
+#pragma once
+#include <fcntl.h>
+#include <unistd.h>  //open and close
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "graph_stream.h"
+
+/* A binary stream format that stores updates in compressed, independently decodable blocks
+ *
+ * File layout:
+ *   header:  num_vertices | num_edges | block_size (uint32_t) | num_blocks | index_offset
+ *   blocks:  num_blocks compressed blocks, each holding up to block_size updates
+ *   index:   num_blocks + 1 uint64_t byte offsets, block b spans [index[b], index[b+1])
+ *
+ * Block layout:
+ *   varint number of updates in the block
+ *   bit-packed update types, one bit per update
+ *   per update: zigzag varint of (src - previous src), zigzag varint of (dst - src)
+ *
+ * Because every block starts from a previous src of 0 and its offset is in the index, the block
+ * holding update i is found in O(1) and decoded without touching any other block. Readers claim
+ * update ranges with an atomic (exactly like BinaryFileStream) and decode blocks into a
+ * thread-local cache, so decoding is thread safe and runs in parallel across blocks.
+ *
+ * Writing is sequential. The index and final header are written when the stream is destroyed.
+ */
+class CompressedBinaryStream : public GraphStream {
+ public:
+  /**
+   * Open a CompressedBinaryStream
+   * @param file_name       Name of the stream file
+   * @param open_read_only  If true, open an existing stream for reading. If false, create or
+   *                        truncate the file and open it for writing only.
+   * @param block_size      Number of updates per block. Only used when writing.
+   */
+  CompressedBinaryStream(std::string file_name, bool open_read_only = true,
+                         uint32_t block_size = 65536)
+      : read_only(open_read_only), file_name(file_name), block_size(block_size) {
+    if (read_only)
+      stream_fd = open(file_name.c_str(), O_RDONLY, S_IRUSR);
+    else
+      stream_fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+    if (stream_fd == -1)
+      throw StreamException("CompressedBinaryStream: Could not open stream file " + file_name +
+                            ". Does it exist?");
+
+    if (read_only) {
+      read_header();
+    } else {
+      if (block_size == 0) throw StreamException("CompressedBinaryStream: block_size must be > 0");
+      pending.reserve(block_size);
+      index.push_back(uint64_t(header_size));
+      write_header(0, 0);
+    }
+    stream_off = 0;
+    set_break_point(-1);
+  }
+
+  ~CompressedBinaryStream() {
+    if (!read_only) {
+      try {
+        finalize();
+      } catch (StreamException& e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+    close(stream_fd);
+  }
+
+  inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates) {
+    assert(upd_buf != nullptr);
+    if (!read_only) throw StreamException("CompressedBinaryStream: stream not open for reading!");
+
+    // many threads may execute this line simultaneously creating edge cases
+    size_t upds_to_read = num_updates;
+    size_t read_idx = stream_off.fetch_add(upds_to_read, std::memory_order_relaxed);
+
+    // catch these edge cases here
+    if (read_idx + upds_to_read > break_index) {
+      upds_to_read = read_idx > break_index ? 0 : break_index - read_idx;
+      stream_off = break_index.load();
+    }
+
+    // decode every block overlapping [read_idx, read_idx + upds_to_read)
+    size_t upds_read = 0;
+    while (upds_read < upds_to_read) {
+      size_t upd_idx = read_idx + upds_read;
+      const std::vector<GraphStreamUpdate>& block = decode_block(upd_idx / block_size);
+      size_t block_pos = upd_idx % block_size;
+      if (block_pos >= block.size())
+        throw StreamException("CompressedBinaryStream: Stream has fewer updates than its header");
+      size_t to_copy = std::min(upds_to_read - upds_read, block.size() - block_pos);
+      memcpy(upd_buf + upds_read, block.data() + block_pos, to_copy * sizeof(GraphStreamUpdate));
+      upds_read += to_copy;
+    }
+
+    if (upds_read < num_updates) {
+      GraphStreamUpdate& upd = upd_buf[upds_read];
+      upd.type = BREAKPOINT;
+      upd.edge = {0, 0};
+      return upds_read + 1;
+    }
+    return upds_read;
+  }
+
+  // get_update_buffer() is thread safe
+  inline bool get_update_is_thread_safe() { return true; }
+
+  // record the number of nodes and edges. The header is rewritten with the index at the end.
+  inline void write_header(node_id_t num_verts, edge_id_t num_edg) {
+    if (read_only) throw StreamException("CompressedBinaryStream: stream not open for writing!");
+    num_vertices = num_verts;
+    num_edges = num_edg;
+    write_header_to_file();
+  }
+
+  // append updates to the stream, compressing every full block. Not thread safe.
+  inline void write_updates(GraphStreamUpdate* upd, edge_id_t num_updates) {
+    if (read_only) throw StreamException("CompressedBinaryStream: stream not open for writing!");
+
+    for (edge_id_t i = 0; i < num_updates; i++) {
+      pending.push_back(upd[i]);
+      if (pending.size() >= block_size) flush_block();
+    }
+  }
+
+  // seek to a position in the stream
+  inline void seek(edge_id_t edge_idx) { stream_off = edge_idx; }
+
+  inline bool set_break_point(edge_id_t break_idx) {
+    if (break_idx < stream_off) return false;
+    break_index = break_idx;
+    if (break_index > num_edges) break_index = num_edges;
+    return true;
+  }
+
+  inline void serialize_metadata(std::ostream& out) {
+    out << CompressedBinaryFile << " " << file_name << std::endl;
+  }
+
+  static GraphStream* construct_from_metadata(std::istream& in) {
+    std::string file_name_from_stream;
+    in >> file_name_from_stream;
+    return new CompressedBinaryStream(file_name_from_stream);
+  }
+
+ private:
+  int stream_fd;
+  std::atomic<edge_id_t> stream_off;
+  std::atomic<edge_id_t> break_index;
+  const bool read_only;  // is stream read only?
+  const std::string file_name;
+  uint32_t block_size;
+  std::vector<uint64_t> index;  // byte offset of each block and of the end of the blocks
+
+  // writer state
+  std::vector<GraphStreamUpdate> pending;  // updates of the block being built
+  std::vector<uint8_t> encode_buf;
+  bool finalized = false;
+
+  // a unique id per stream object so thread-local decode caches are never confused
+  const size_t stream_id = next_stream_id()++;
+
+  static constexpr size_t header_size =
+      sizeof(node_id_t) + sizeof(edge_id_t) + sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+  static std::atomic<size_t>& next_stream_id() {
+    static std::atomic<size_t> id{0};
+    return id;
+  }
+
+  static inline uint64_t zigzag_encode(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+  static inline int64_t zigzag_decode(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+  static inline void put_varint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+      out.push_back(uint8_t(v) | 0x80);
+      v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+  }
+
+  static inline uint64_t get_varint(const uint8_t*& pos, const uint8_t* end) {
+    uint64_t v = 0;
+    for (size_t shift = 0; pos < end && shift < 64; shift += 7) {
+      uint8_t byte = *pos++;
+      v |= uint64_t(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) return v;
+    }
+    throw StreamException("CompressedBinaryStream: Corrupt block encountered");
+  }
+
+  void pread_all(void* buf, size_t bytes, size_t offset) {
+    size_t bytes_read = 0;
+    while (bytes_read < bytes) {
+      ssize_t r = pread(stream_fd, (char*)buf + bytes_read, bytes - bytes_read, offset + bytes_read);
+      if (r == -1) throw StreamException("CompressedBinaryStream: Could not perform pread");
+      if (r == 0) throw StreamException("CompressedBinaryStream: pread() got no data");
+      bytes_read += r;
+    }
+  }
+
+  void pwrite_all(const void* buf, size_t bytes, size_t offset) {
+    size_t bytes_written = 0;
+    while (bytes_written < bytes) {
+      ssize_t r = pwrite(stream_fd, (const char*)buf + bytes_written, bytes - bytes_written,
+                         offset + bytes_written);
+      if (r == -1) throw StreamException("CompressedBinaryStream: Could not perform pwrite");
+      bytes_written += r;
+    }
+  }
+
+  void read_header() {
+    char header[header_size];
+    try {
+      pread_all(header, header_size, 0);
+    } catch (StreamException&) {
+      throw StreamException("CompressedBinaryStream: Could not read header");
+    }
+    uint64_t num_blocks, index_offset;
+    char* pos = header;
+    memcpy(&num_vertices, pos, sizeof(num_vertices)); pos += sizeof(num_vertices);
+    memcpy(&num_edges, pos, sizeof(num_edges));       pos += sizeof(num_edges);
+    memcpy(&block_size, pos, sizeof(block_size));     pos += sizeof(block_size);
+    memcpy(&num_blocks, pos, sizeof(num_blocks));     pos += sizeof(num_blocks);
+    memcpy(&index_offset, pos, sizeof(index_offset));
+
+    if (block_size == 0 || index_offset < header_size ||
+        num_edges > num_blocks * uint64_t(block_size))
+      throw StreamException("CompressedBinaryStream: Invalid header, was the stream finalized?");
+
+    index.resize(num_blocks + 1);
+    pread_all(index.data(), index.size() * sizeof(uint64_t), index_offset);
+  }
+
+  void write_header_to_file() {
+    uint64_t num_blocks = index.size() - 1;
+    uint64_t index_offset = index.back();
+    char header[header_size];
+    char* pos = header;
+    memcpy(pos, &num_vertices, sizeof(num_vertices)); pos += sizeof(num_vertices);
+    memcpy(pos, &num_edges, sizeof(num_edges));       pos += sizeof(num_edges);
+    memcpy(pos, &block_size, sizeof(block_size));     pos += sizeof(block_size);
+    memcpy(pos, &num_blocks, sizeof(num_blocks));     pos += sizeof(num_blocks);
+    memcpy(pos, &index_offset, sizeof(index_offset));
+    pwrite_all(header, header_size, 0);
+  }
+
+  // compress the pending updates into a block at the end of the file
+  void flush_block() {
+    if (pending.empty()) return;
+
+    encode_buf.clear();
+    put_varint(encode_buf, pending.size());
+    size_t types_pos = encode_buf.size();
+    encode_buf.resize(types_pos + (pending.size() + 7) / 8, 0);
+    for (size_t i = 0; i < pending.size(); i++)
+      encode_buf[types_pos + i / 8] |= uint8_t((pending[i].type & 1) << (i % 8));
+
+    node_id_t prev_src = 0;
+    for (auto& upd : pending) {
+      put_varint(encode_buf, zigzag_encode(int64_t(upd.edge.src) - int64_t(prev_src)));
+      put_varint(encode_buf, zigzag_encode(int64_t(upd.edge.dst) - int64_t(upd.edge.src)));
+      prev_src = upd.edge.src;
+    }
+
+    pwrite_all(encode_buf.data(), encode_buf.size(), index.back());
+    index.push_back(index.back() + encode_buf.size());
+    pending.clear();
+  }
+
+  // write the final block, the block index, and the header
+  void finalize() {
+    if (finalized) return;
+    flush_block();
+    pwrite_all(index.data(), index.size() * sizeof(uint64_t), index.back());
+    write_header_to_file();
+    finalized = true;
+  }
+
+  // decode a block into this thread's cache. Returns the decoded updates of the block.
+  const std::vector<GraphStreamUpdate>& decode_block(size_t block) {
+    struct DecodeCache {
+      size_t stream_id = size_t(-1);
+      size_t block = size_t(-1);
+      std::vector<uint8_t> bytes;
+      std::vector<GraphStreamUpdate> updates;
+    };
+    static thread_local DecodeCache cache;
+    if (cache.stream_id == stream_id && cache.block == block) return cache.updates;
+
+    if (block + 1 >= index.size())
+      throw StreamException("CompressedBinaryStream: Block index out of range");
+    cache.stream_id = size_t(-1);  // invalid until decoding succeeds
+    cache.bytes.resize(index[block + 1] - index[block]);
+    pread_all(cache.bytes.data(), cache.bytes.size(), index[block]);
+
+    const uint8_t* pos = cache.bytes.data();
+    const uint8_t* end = pos + cache.bytes.size();
+    size_t count = get_varint(pos, end);
+    const uint8_t* types = pos;
+    pos += (count + 7) / 8;
+    if (count > block_size || pos > end)
+      throw StreamException("CompressedBinaryStream: Corrupt block encountered");
+
+    cache.updates.resize(count);
+    node_id_t src = 0;
+    for (size_t i = 0; i < count; i++) {
+      GraphStreamUpdate& upd = cache.updates[i];
+      upd.type = (types[i / 8] >> (i % 8)) & 1;
+      src = node_id_t(int64_t(src) + zigzag_decode(get_varint(pos, end)));
+      upd.edge.src = src;
+      upd.edge.dst = node_id_t(int64_t(src) + zigzag_decode(get_varint(pos, end)));
+    }
+    cache.stream_id = stream_id;
+    cache.block = block;
+    return cache.updates;
+  }
+};
@@ -1,25 +1,57 @@
 #pragma once
 #include "stream_types.h"
-#include <vector>
+#include "memory_graph_stream.h"
+#include "permuted_set.h"
 #include <string>
 
-// Fairly inefficient dynamic erdos graph stream generator
-// Builds a vector of resulting edges, augments it with insertions and deletions, then shuffles
-// all the edge updates and labels them appropriately.
+// Dynamic erdos graph stream generator
+// The stream is defined by two pseudo-random permutations and generated lazily in O(1) memory.
+// A permutation of the vertex pairs selects the edges: the first few pairs are the edges of the
+// final graph, some of which are deleted and reinserted, and the following pairs are additional
+// edges that are inserted and deleted again. A permutation of the update indices interleaves all
+// of these updates. The type of an update is determined by how many updates to the same edge
+// precede it in the stream, so any range of the stream can be generated independently.
 class DynamicErdosGenerator {
  private:
-  std::vector<GraphStreamUpdate> updates;
-  std::vector<Edge> true_edges;
   node_id_t num_vertices;
   size_t seed;
-  edge_id_t total_edges;
   double density;
-  double stream_vary;
+
+  size_t num_pairs;            // number of distinct vertex pairs
+  size_t num_true;             // number of edges in the final graph (T)
+  size_t num_reinserted;       // number of final edges deleted and reinserted each round (D)
+  size_t num_adtl;             // number of edges not in the graph added and deleted each round (A)
+  size_t rounds;               // (R)
+  edge_id_t total_edges;       // number of updates in the stream
+  PermutedSet edge_permute;    // edge rank -> vertex pair
+  PermutedSet update_permute;  // stream index -> canonical update index
   edge_id_t edge_idx = 0;
+
+  static constexpr size_t update_chunk = 1 << 20;  // updates generated by a thread at once
+  static constexpr size_t permute_batch_size = 1024;
+
+  /*
+   * Canonical update indices place the updates of each edge rank at known positions:
+   *   [0, T)              the first insertion of each of the T final edges
+   *   [T, T + 2RD)        R delete and reinsert pairs of each of the first D final edges
+   *   [T + 2RD, total)    R insert and delete pairs of each of the A additional edges
+   * These return the edge rank of a canonical index and the canonical indices of an edge rank.
+   */
+  size_t edge_of(size_t canonical) const;
+  size_t num_occurrences(size_t edge_rank) const;
+  size_t occurrence(size_t edge_rank, size_t k) const;
+
+  // the update at stream index stream_idx, whose canonical index is canonical
+  GraphStreamUpdate make_update(edge_id_t stream_idx, size_t canonical) const;
+
+  // throws if the parameters are out of range, before any member depending on them is built.
+  // Returns the density.
+  static double check_parameters(double density, double portion_delete, double portion_adtl,
+                                 size_t rounds);
  public:
   /*
    * Constructor
-   * @param seed            the seed to our vector shuffles
+   * @param seed            the seed to our permutations
    * @param num_vertices    number of vertices in the graph
    * @param density         resulting density of the graph after the stream
    * @param portion_delete  proportion of edges to delete from stream and reinsert
@@ -30,12 +62,24 @@ class DynamicErdosGenerator {
                         double portion_adtl, size_t rounds);
 
   // these functions write all the stream edges to a file
-  void to_binary_file(std::string file_name);
+  // to_binary_file generates and writes the stream in parallel, with num_threads threads or one
+  // per hardware thread if 0. The file is identical for any number of threads.
+  void to_binary_file(std::string file_name, size_t num_threads = 0);
+  void to_compact_binary_file(std::string file_name);  // at most 2^31 vertices
   void to_ascii_file(std::string file_name);
+  // generates the stream in parallel directly into the arena of a MemoryGraphStream
+  void to_memory_stream(MemoryGraphStream &stream, size_t num_threads = 0);
   void write_cumulative_file(std::string file_name);
 
   GraphStreamUpdate get_next_edge();
 
+  /*
+   * Get the updates with stream indices [begin, end). This is independent of get_next_edge() and
+   * thread safe.
+   * @param upds   Buffer of at least end - begin updates to place the updates in.
+   */
+  void get_updates(edge_id_t begin, edge_id_t end, GraphStreamUpdate *upds) const;
+
   // getters
   node_id_t get_num_vertices() { return num_vertices; }
   edge_id_t get_num_edges() { return total_edges; }
@@ -0,0 +1,247 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "graph_stream.h"
+#include "vertex_pairs.h"
+
+// The set of edges present in a graph, as tracked while processing a stream of updates.
+//
+// Two backends are available:
+//   Dense:  A flat triangular bitmap with one bit per vertex pair, V(V-1)/16 bytes.
+//   Sparse: An open addressing hash table of the present edges with linear probing and backward
+//           shift deletion, roughly 16 to 32 bytes per present edge.
+// With Auto the backend is chosen by comparing the size of the bitmap to the size of a table
+// holding the expected number of edges.
+//
+// Toggles may be batched with toggle_and_get(), which prefetches the memory of the next updates
+// before applying them in order.
+//
+// The set may be split into shards, each of which holds a disjoint part of the vertex pairs so
+// that threads can track the shards independently. The dense backend assigns blocks of the bitmap
+// to shards round robin and the sparse backend assigns edges by hash. shard_of() gives the shard
+// that owns an edge.
+class EdgeStateSet {
+ public:
+  enum Backend { Auto, Dense, Sparse };
+
+  /**
+   * Create an empty EdgeStateSet
+   * @param num_vertices    Number of vertices in the graph.
+   * @param expected_edges  An upper bound on the number of edges present at once, such as the
+   *                        number of updates in the stream. 0 if unknown.
+   * @param backend         The backend to use, or Auto to choose by size. All shards of a set
+   *                        must use the same backend.
+   * @param num_shards      Number of shards the set is split into.
+   * @param shard           The shard held by this EdgeStateSet. Only edges for which
+   *                        shard_of(edge) == shard may be accessed.
+   */
+  EdgeStateSet(node_id_t num_vertices, size_t expected_edges = 0, Backend backend = Auto,
+               size_t num_shards = 1, size_t shard = 0)
+      : num_vertices(num_vertices),
+        num_pairs(num_vertex_pairs(num_vertices)),
+        num_shards(num_shards),
+        shard(shard) {
+    if (num_shards == 0 || shard >= num_shards)
+      throw StreamException("EdgeStateSet: shard out of range");
+    if (backend == Auto) backend = choose_backend(num_vertices, expected_edges);
+    dense = backend == Dense;
+
+    if (dense) {
+      size_t num_blocks = (num_pairs + block_bits - 1) / block_bits;
+      bits.assign((num_blocks + num_shards - 1) / num_shards * block_words, 0);
+    } else {
+      table.assign(size_t(min_table_size), uint64_t(empty_key));
+    }
+  }
+
+  // the shard that owns the edge
+  inline size_t shard_of(Edge edge) const {
+    if (num_shards == 1) return 0;
+    if (dense) return (pair_index(edge) / block_bits) % num_shards;
+    return (mix(edge_key(edge)) >> 32) % num_shards;
+  }
+  inline bool owns(Edge edge) const { return shard_of(edge) == shard; }
+
+  // is the edge present
+  inline bool get(Edge edge) const {
+    assert(owns(edge));
+    if (dense) {
+      size_t idx = local_index(edge);
+      return (bits[idx / 64] >> (idx % 64)) & 1;
+    }
+    return table[find_slot(edge_key(edge))] != empty_key;
+  }
+
+  // toggle the presence of the edge, returns true if the edge was present before the toggle
+  inline bool toggle(Edge edge) {
+    assert(owns(edge));
+    bool was_present;
+    if (dense) {
+      size_t idx = local_index(edge);
+      uint64_t mask = uint64_t(1) << (idx % 64);
+      was_present = bits[idx / 64] & mask;
+      bits[idx / 64] ^= mask;
+    } else {
+      uint64_t key = edge_key(edge);
+      size_t slot = find_slot(key);
+      was_present = table[slot] != empty_key;
+      if (was_present) {
+        erase_slot(slot);
+      } else {
+        table[slot] = key;
+        if ((num_present + 1) * 2 > table.size()) grow_table();
+      }
+    }
+    if (was_present)
+      --num_present;
+    else
+      ++num_present;
+    return was_present;
+  }
+
+  /**
+   * Toggle a batch of edges in order. Equivalent to was_present[i] = toggle(edges[i]), but the
+   * memory of upcoming edges is prefetched while earlier ones are applied.
+   * @param edges        The edges to toggle. The same edge may appear many times.
+   * @param num_edges    Number of edges to toggle.
+   * @param was_present  Set to whether each edge was present before it was toggled.
+   */
+  inline void toggle_and_get(const Edge* edges, size_t num_edges, bool* was_present) {
+    constexpr size_t prefetch_distance = 16;
+    for (size_t i = 0; i < std::min(prefetch_distance, num_edges); i++) prefetch(edges[i]);
+    for (size_t i = 0; i < num_edges; i++) {
+      if (i + prefetch_distance < num_edges) prefetch(edges[i + prefetch_distance]);
+      was_present[i] = toggle(edges[i]);
+    }
+  }
+
+  // call f(Edge) for every present edge of the shard in increasing (src, dst) order
+  template <typename Func>
+  void for_each_edge(Func f) const {
+    if (dense) {
+      // walk the rows of the triangle, src owns the pair indices [row_begin, row_end)
+      node_id_t src = 0;
+      size_t row_begin = 0;
+      size_t row_end = num_vertices - 1;
+      for (size_t w = 0; w < bits.size(); w++) {
+        size_t block = (w / block_words) * num_shards + shard;
+        size_t word_begin = block * block_bits + (w % block_words) * 64;
+        for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+          size_t idx = word_begin + __builtin_ctzll(word);
+          while (idx >= row_end) {
+            ++src;
+            row_begin = row_end;
+            row_end += num_vertices - src - 1;
+          }
+          f(Edge{src, node_id_t(src + 1 + idx - row_begin)});
+        }
+      }
+    } else {
+      std::vector<uint64_t> keys;
+      keys.reserve(num_present);
+      for (uint64_t key : table)
+        if (key != empty_key) keys.push_back(key);
+      std::sort(keys.begin(), keys.end());
+      for (uint64_t key : keys) f(Edge{node_id_t(key >> 32), node_id_t(key)});
+    }
+  }
+
+  // number of present edges in the shard
+  size_t size() const { return num_present; }
+  Backend backend() const { return dense ? Dense : Sparse; }
+
+  // the backend Auto chooses for a graph
+  static Backend choose_backend(node_id_t num_vertices, size_t expected_edges) {
+    size_t dense_bytes = num_vertex_pairs(num_vertices) / 8;
+    if (expected_edges == 0) return dense_bytes <= unknown_dense_limit ? Dense : Sparse;
+    size_t sparse_bytes = std::min(expected_edges, num_vertex_pairs(num_vertices)) * 32;
+    return dense_bytes <= sparse_bytes ? Dense : Sparse;
+  }
+
+ private:
+  node_id_t num_vertices;
+  size_t num_pairs;
+  size_t num_shards;
+  size_t shard;
+  size_t num_present = 0;
+  bool dense;
+
+  std::vector<uint64_t> bits;   // dense backend
+  std::vector<uint64_t> table;  // sparse backend, keys are src << 32 | dst
+
+  static constexpr uint64_t empty_key = uint64_t(-1);  // src == dst never occurs
+  static constexpr size_t min_table_size = 1024;
+  static constexpr size_t unknown_dense_limit = size_t(1) << 30;
+  static constexpr size_t block_words = 64;  // bitmap words assigned to a shard at once
+  static constexpr size_t block_bits = block_words * 64;
+
+  // index of the edge in the triangular bitmap, rows are ordered by src
+  inline size_t pair_index(Edge edge) const {
+    size_t src = std::min(edge.src, edge.dst);
+    size_t dst = std::max(edge.src, edge.dst);
+    assert(src != dst && dst < num_vertices);
+    return src * (2 * size_t(num_vertices) - src - 1) / 2 + (dst - src - 1);
+  }
+
+  // index of the edge within the bitmap of this shard
+  inline size_t local_index(Edge edge) const {
+    size_t idx = pair_index(edge);
+    if (num_shards == 1) return idx;
+    return (idx / block_bits / num_shards) * block_bits + idx % block_bits;
+  }
+
+  static inline uint64_t edge_key(Edge edge) {
+    assert(edge.src != edge.dst);
+    return uint64_t(std::min(edge.src, edge.dst)) << 32 | std::max(edge.src, edge.dst);
+  }
+
+  static inline uint64_t mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    return key ^ (key >> 33);
+  }
+
+  inline size_t home_slot(uint64_t key) const { return mix(key) & (table.size() - 1); }
+
+  // the slot holding key, or the empty slot where it would be inserted
+  inline size_t find_slot(uint64_t key) const {
+    size_t slot = home_slot(key);
+    while (table[slot] != key && table[slot] != empty_key) slot = (slot + 1) & (table.size() - 1);
+    return slot;
+  }
+
+  // remove the key in slot, shifting back later keys of the cluster so no tombstones are needed
+  inline void erase_slot(size_t slot) {
+    size_t mask = table.size() - 1;
+    size_t next = (slot + 1) & mask;
+    while (table[next] != empty_key) {
+      // the key in next may fill the hole if its home is not within (slot, next]
+      size_t home = home_slot(table[next]);
+      if (((next - home) & mask) >= ((next - slot) & mask)) {
+        table[slot] = table[next];
+        slot = next;
+      }
+      next = (next + 1) & mask;
+    }
+    table[slot] = empty_key;
+  }
+
+  void grow_table() {
+    std::vector<uint64_t> old_table(table.size() * 2, uint64_t(empty_key));
+    std::swap(table, old_table);
+    for (uint64_t key : old_table)
+      if (key != empty_key) table[find_slot(key)] = key;
+  }
+
+  inline void prefetch(Edge edge) const {
+    if (dense)
+      __builtin_prefetch(&bits[local_index(edge) / 64]);
+    else
+      __builtin_prefetch(&table[home_slot(edge_key(edge))]);
+  }
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "graph_stream.h"
+
+// A stream update tagged with its index in the stream. The edge is stored with src < dst and
+// swapped records whether the stream had them the other way around.
+#pragma pack(push,1)
+struct IndexedUpdate {
+  node_id_t src;
+  node_id_t dst;
+  uint64_t idx;
+  uint8_t type;     // UpdateType, any value of the stream is kept
+  uint8_t swapped;  // the stream had dst before src
+
+  inline UpdateType update_type() const { return UpdateType(type); }
+  inline Edge edge() const { return {src, dst}; }
+  inline Edge stream_edge() const { return swapped ? Edge{dst, src} : Edge{src, dst}; }
+  inline bool same_edge(const IndexedUpdate &oth) const {
+    return src == oth.src && dst == oth.dst;
+  }
+};
+#pragma pack(pop)
+
+// Sorts stream updates by (src, dst, index) within a bounded amount of memory.
+// Updates are gathered in a buffer the size of the memory budget. Whenever the buffer is full it
+// is split between the threads, each of which sorts its part, and the threads then merge the
+// parts into a single sorted run on disk, each writing the updates of one range of keys. Runs are
+// merged with a k-way merge of at most fan_in runs at a time: whenever fan_in runs of the same
+// level accumulate they are merged into one run of the next level, and finish() merges the
+// smallest runs until the rest can be merged while they are read. This bounds the number of open
+// files, and the read buffers of a merge share the memory budget. If all updates fit in the budget
+// nothing is written to disk and the in memory parts are merged directly.
+class ExternalUpdateSorter {
+ public:
+  /**
+   * Create an empty ExternalUpdateSorter
+   * @param temp_dir     Directory in which to place sorted runs. Runs are unnamed files where
+   *                     the file system supports O_TMPFILE, so nothing remains if the process
+   *                     dies. Elsewhere they are unlinked files in an update_sort_XXXXXX
+   *                     directory, which the destructor removes but a crash leaves behind.
+   * @param mem_bytes    Memory budget of the sorter in bytes.
+   * @param num_threads  Number of threads sorting runs.
+   */
+  ExternalUpdateSorter(std::string temp_dir, size_t mem_bytes, size_t num_threads = 1);
+  ~ExternalUpdateSorter();
+
+  ExternalUpdateSorter(const ExternalUpdateSorter &) = delete;
+  ExternalUpdateSorter &operator=(const ExternalUpdateSorter &) = delete;
+
+  // add an update with the given stream index. Self loops are allowed.
+  inline void add(Edge edge, UpdateType type, size_t idx) {
+    if (finished) throw StreamException("ExternalUpdateSorter: add after finish");
+    IndexedUpdate upd;
+    upd.src = std::min(edge.src, edge.dst);
+    upd.dst = std::max(edge.src, edge.dst);
+    upd.idx = idx;
+    upd.type = uint8_t(type);
+    upd.swapped = edge.src > edge.dst;
+    buffer.push_back(upd);
+    if (buffer.size() == buffer_capacity) write_runs();
+    ++num_updates;
+  }
+
+  // end the input. The updates may be read in sorted order afterwards.
+  void finish();
+
+  // read up to max_upds of the next updates in sorted order. Returns 0 once all were read.
+  size_t read(IndexedUpdate *upds, size_t max_upds);
+
+  size_t size() const { return num_updates; }
+  size_t runs_on_disk() const { return num_disk_runs; }
+
+ private:
+  // A sorted sequence of updates, either in memory or in a file read through a buffer
+  struct Run {
+    const IndexedUpdate *cur = nullptr;
+    const IndexedUpdate *end = nullptr;
+    int fd = -1;
+    size_t file_off = 0;  // next update of the file to read
+    size_t file_size = 0;  // in updates
+    size_t level = 0;  // number of merges of spilled runs that produced the run
+    IndexedUpdate *read_buf = nullptr;  // part of the buffer, during a merge
+    size_t read_buf_size = 0;
+  };
+
+  std::string temp_dir;
+  std::string run_dir;  // created on the first write of a run
+  size_t num_threads;
+  size_t spill_buffer;  // updates, write buffer of each thread merging a spill
+  size_t buffer_capacity;
+  size_t fan_in;  // maximum number of runs merged at once
+  std::vector<IndexedUpdate> buffer;  // also provides the read buffers of merges
+  std::vector<Run> runs;
+  std::vector<Run *> heap;  // runs with updates left, by their current update
+  size_t num_updates = 0;
+  size_t num_disk_runs = 0;
+  size_t num_run_files = 0;
+  bool finished = false;
+
+  static constexpr size_t min_read_buffer = 4096;  // updates
+  static constexpr size_t max_fan_in = 256;
+
+  // sort the buffer in parts, merge the parts into a run on disk, then empty the buffer
+  void write_runs();
+  // sort the buffer in parts and keep the parts as in memory runs
+  void sort_in_memory();
+  // merge the last num runs into a single run that replaces them
+  void merge_runs(size_t num);
+  // create an unlinked run file and return its descriptor
+  int create_run_file();
+  // read the next updates of a file run, returns false if there are none
+  bool refill(Run &run);
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "graph_stream.h"
+
+// How copy_file() copied a file
+enum FileCopyMethod { Reflink, CopyFileRange, Sendfile, ReadWrite };
+
+inline std::string copy_method_string(FileCopyMethod method) {
+  if (method == Reflink) return "reflink";
+  if (method == CopyFileRange) return "copy_file_range";
+  if (method == Sendfile) return "sendfile";
+  return "read/write";
+}
+
+// Copy a file, preferring methods that do not move the data through user space:
+//   Reflink:        FICLONE shares the data blocks on copy on write filesystems (btrfs, XFS).
+//   CopyFileRange:  Copies within the kernel, or on the server for network filesystems.
+//   Sendfile:       Copies within the kernel on kernels without copy_file_range across files.
+//   ReadWrite:      Copies through a user space buffer.
+// A method that is not supported falls through to the next one, continuing where the previous
+// method stopped. Throws a StreamException on failure and returns the method that finished.
+inline FileCopyMethod copy_file(std::string src_file_name, std::string dst_file_name) {
+  int src_fd = open(src_file_name.c_str(), O_RDONLY);
+  if (src_fd == -1)
+    throw StreamException("copy_file: Could not open " + src_file_name + ": " + strerror(errno));
+  int dst_fd = open(dst_file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (dst_fd == -1) {
+    close(src_fd);
+    throw StreamException("copy_file: Could not open " + dst_file_name + ": " + strerror(errno));
+  }
+  auto fail = [&](std::string what) {
+    std::string err = strerror(errno);
+    close(src_fd);
+    close(dst_fd);
+    throw StreamException("copy_file: " + what + " failed copying " + src_file_name + ": " + err);
+  };
+
+  struct stat src_stat;
+  if (fstat(src_fd, &src_stat) == -1) fail("fstat");
+  size_t size = src_stat.st_size;
+  size_t done = 0;
+  // errors meaning that a method is not supported for these files
+  auto unsupported = [](int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == ENOTTY ||
+           err == EBADF;
+  };
+
+#ifdef __linux__
+  if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+    close(src_fd);
+    close(dst_fd);
+    return Reflink;
+  }
+
+  while (done < size) {
+    loff_t src_off = done;
+    loff_t dst_off = done;
+    ssize_t r = copy_file_range(src_fd, &src_off, dst_fd, &dst_off, size - done, 0);
+    if (r == -1 && errno == EINTR) continue;
+    if (r == -1 && unsupported(errno)) break;
+    if (r == -1) fail("copy_file_range");
+    if (r == 0) break;  // the file shrank, or the filesystem reports no progress
+    done += r;
+  }
+  if (done == size) {
+    close(src_fd);
+    close(dst_fd);
+    return CopyFileRange;
+  }
+
+  bool sendfile_supported = true;
+  while (done < size) {
+    off_t src_off = done;
+    if (lseek(dst_fd, done, SEEK_SET) == -1) fail("lseek");
+    ssize_t r = sendfile(dst_fd, src_fd, &src_off, size - done);
+    if (r == -1 && errno == EINTR) continue;
+    if (r == -1 && unsupported(errno)) {
+      sendfile_supported = false;
+      break;
+    }
+    if (r == -1) fail("sendfile");
+    if (r == 0) break;
+    done += r;
+  }
+  if (done == size && sendfile_supported) {
+    close(src_fd);
+    close(dst_fd);
+    return Sendfile;
+  }
+#else
+  (void) unsupported;
+#endif
+
+  std::vector<char> buf(1 << 20);
+  while (done < size) {
+    ssize_t r = pread(src_fd, buf.data(), std::min(buf.size(), size - done), done);
+    if (r == -1 && errno == EINTR) continue;
+    if (r == -1) fail("read");
+    if (r == 0) break;
+    for (ssize_t written = 0; written < r;) {
+      ssize_t w = pwrite(dst_fd, buf.data() + written, r - written, done + written);
+      if (w == -1 && errno == EINTR) continue;
+      if (w == -1) fail("write");
+      written += w;
+    }
+    done += r;
+  }
+  close(src_fd);
+  close(dst_fd);
+  return ReadWrite;
+}
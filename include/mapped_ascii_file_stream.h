@@ -0,0 +1,212 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>  //open and close
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "ascii_line_index.h"
+#include "graph_stream.h"
+
+// A read only, thread safe reader for files in the AsciiFileStream format. The file is mapped
+// into memory and parsed with a hand-written integer scanner instead of std::fstream.
+//
+// Each get_update_buffer() call claims a range of update indices under a lock, which takes
+// constant time, so break points remain exact. The claiming thread then finds the line of its
+// first update and parses its lines without holding the lock. It starts from the closest line
+// known to the stream: the line in the sidecar AsciiLineIndex at or before the first update, or
+// the end of the latest range read, whichever is closer. The index is built on first use.
+class MappedAsciiFileStream : public GraphStream {
+ public:
+  /**
+   * Open a MappedAsciiFileStream
+   * @param file_name  Name of the stream file. Must be in the AsciiFileStream format.
+   * @param has_type   If true, every update line begins with its type.
+   */
+  MappedAsciiFileStream(std::string file_name, bool has_type = true)
+      : file_name(file_name), has_type(has_type) {
+    int stream_fd = open(file_name.c_str(), O_RDONLY);
+    if (stream_fd == -1)
+      throw StreamException("MappedAsciiFileStream: could not open " + file_name);
+
+    struct stat file_stat;
+    if (fstat(stream_fd, &file_stat) == -1 || file_stat.st_size == 0) {
+      close(stream_fd);
+      throw StreamException("MappedAsciiFileStream: could not read header of " + file_name);
+    }
+    map_size = file_stat.st_size;
+
+    void* addr = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, stream_fd, 0);
+    close(stream_fd);  // the mapping remains valid after the fd is closed
+    if (addr == MAP_FAILED) {
+      perror("MappedAsciiFileStream");
+      throw StreamException("MappedAsciiFileStream: could not map " + file_name);
+    }
+    map = static_cast<const char*>(addr);
+    map_end = map + map_size;
+    madvise(addr, map_size, MADV_SEQUENTIAL);
+
+    // parse the header line
+    const char* pos = AsciiLineIndex::skip_blank_lines(map, map_end);
+    try {
+      num_vertices = scan_uint(pos, map_end);
+      num_edges = scan_uint(pos, map_end);
+    } catch (StreamException&) {
+      munmap(addr, map_size);
+      throw StreamException("MappedAsciiFileStream: could not read header of " + file_name);
+    }
+    data_start = next_update(next_line(pos));
+    latest = {0, data_start};
+  }
+
+  ~MappedAsciiFileStream() { munmap((void*)map, map_size); }
+
+  inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates) {
+    edge_id_t first_update;
+    return get_update_buffer(upd_buf, num_updates, first_update);
+  }
+
+  // as above, and sets first_update to the stream index of upd_buf[0]. This lets threads that
+  // read concurrently put their buffers back in stream order.
+  inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates,
+                                  edge_id_t& first_update) {
+    assert(upd_buf != nullptr);
+
+    // claim update indices, and the closest known line at or before the first
+    size_t upds_to_read = 0;
+    KnownLine start;
+    {
+      std::lock_guard<std::mutex> lk(claim_lock);
+      if (!line_index) line_index.reset(new AsciiLineIndex(file_name));
+      edge_id_t limit = std::min(num_edges, break_edge_idx);
+      if (upd_offset < limit) upds_to_read = std::min(edge_id_t(num_updates), limit - upd_offset);
+      first_update = upd_offset;
+      upd_offset += upds_to_read;
+      start = closest_line(first_update);
+    }
+
+    // skip to the first claimed line and parse the claimed lines. The stream ends early if the
+    // file holds fewer updates than its header claims.
+    const char* pos = start.pos;
+    for (edge_id_t i = start.idx; i < first_update && pos < map_end; i++)
+      pos = next_update(next_line(pos));
+    size_t upds_read = 0;
+    for (; upds_read < upds_to_read && pos < map_end; upds_read++) {
+      GraphStreamUpdate& upd = upd_buf[upds_read];
+      upd.type = has_type ? scan_uint(pos, map_end) : uint64_t(INSERT);
+      upd.edge.src = scan_uint(pos, map_end);
+      upd.edge.dst = scan_uint(pos, map_end);
+      pos = next_update(next_line(pos));
+    }
+
+    // later claims may start where this one ended
+    {
+      std::lock_guard<std::mutex> lk(claim_lock);
+      if (first_update + upds_read > latest.idx) latest = {first_update + upds_read, pos};
+    }
+
+    if (upds_read < num_updates) {
+      GraphStreamUpdate& upd = upd_buf[upds_read];
+      upd.type = BREAKPOINT;
+      upd.edge = {0, 0};
+      return upds_read + 1;
+    }
+    return upds_read;
+  }
+
+  // get_update_buffer() is thread safe
+  inline bool get_update_is_thread_safe() { return true; }
+
+  // the mapping is read only
+  inline void write_header(node_id_t, edge_id_t) {
+    throw StreamException("MappedAsciiFileStream: stream is read only!");
+  }
+  inline void write_updates(GraphStreamUpdate*, edge_id_t) {
+    throw StreamException("MappedAsciiFileStream: stream is read only!");
+  }
+
+  // seek to a position in the stream. Reads then start from the line in the sidecar
+  // AsciiLineIndex of the file at or before the position.
+  inline void seek(edge_id_t pos) {
+    std::lock_guard<std::mutex> lk(claim_lock);
+    if (pos > num_edges)
+      throw StreamException("MappedAsciiFileStream: cannot seek past the end of the stream");
+    upd_offset = pos;
+    latest = {0, data_start};
+  }
+
+  inline bool set_break_point(edge_id_t break_idx) {
+    std::lock_guard<std::mutex> lk(claim_lock);
+    if (break_idx < upd_offset) return false;
+    break_edge_idx = break_idx;
+    return true;
+  }
+
+  inline void serialize_metadata(std::ostream& out) {
+    out << MappedAsciiFile << " " << file_name << " " << has_type << std::endl;
+  }
+
+  static GraphStream* construct_from_metadata(std::istream& in) {
+    std::string file_name_from_stream;
+    bool has_type_from_stream;
+    in >> file_name_from_stream >> has_type_from_stream;
+    return new MappedAsciiFileStream(file_name_from_stream, has_type_from_stream);
+  }
+
+ private:
+  const std::string file_name;
+  const bool has_type;
+  const char* map;
+  const char* map_end;
+  size_t map_size;
+  const char* data_start;  // first byte after the header line
+
+  // the line of an update, or the end of the file if the file holds fewer updates
+  struct KnownLine {
+    edge_id_t idx;
+    const char* pos;
+  };
+
+  std::mutex claim_lock;  // protects the claim state below
+  edge_id_t break_edge_idx = -1;
+  edge_id_t upd_offset = 0;
+  KnownLine latest;  // the line after the range read furthest into the stream
+  std::unique_ptr<AsciiLineIndex> line_index;  // built on the first read
+
+  // the closest line known at or before update idx
+  KnownLine closest_line(edge_id_t idx) const {
+    if (!line_index->covers(idx)) return {idx, map_end};
+    size_t skip;
+    KnownLine indexed = {0, map + line_index->locate(idx, skip)};
+    indexed.idx = idx - skip;
+    return latest.idx <= idx && latest.idx > indexed.idx ? latest : indexed;
+  }
+
+  // returns the first byte of the line after the one containing pos
+  static inline const char* next_line(const char* pos, const char* end) {
+    const char* newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+    return newline == nullptr ? end : newline + 1;
+  }
+  inline const char* next_line(const char* pos) { return next_line(pos, map_end); }
+  // the first non-blank line at or after the line start pos, as the fstream >> reader skips them
+  inline const char* next_update(const char* pos) {
+    return AsciiLineIndex::skip_blank_lines(pos, map_end);
+  }
+
+  // parse an unsigned integer, skipping leading blanks on the current line
+  static inline uint64_t scan_uint(const char*& pos, const char* end) {
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r')) ++pos;
+    if (pos >= end || *pos < '0' || *pos > '9')
+      throw StreamException("MappedAsciiFileStream: could not parse update");
+
+    uint64_t value = 0;
+    while (pos < end && *pos >= '0' && *pos <= '9') value = value * 10 + (*pos++ - '0');
+    return value;
+  }
+};
@@ -0,0 +1,177 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>  //open and close
+
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "graph_stream.h"
+#include "update_encoding.h"
+
+// A read only stream over a BinaryFileStream file that maps the file into memory instead of
+// issuing a pread() per batch. Updates can be copied out of the mapping with get_update_buffer()
+// or handed out in place, without any copy, through get_update_view(). Like BinaryFileStream,
+// the record format is selected by the Encoding. Use the typedefs below.
+template <typename Encoding>
+class BasicMappedBinaryFileStream : public GraphStream {
+ public:
+  typedef typename Encoding::record_t record_t;
+
+  /**
+   * Open a MappedBinaryFileStream
+   * @param file_name  Name of the stream file. Must be in the BinaryFileStream format.
+   */
+  BasicMappedBinaryFileStream(std::string file_name) : file_name(file_name) {
+    int stream_fd = open(file_name.c_str(), O_RDONLY);
+    if (stream_fd == -1)
+      throw StreamException("MappedBinaryFileStream: Could not open stream file " + file_name +
+                            ". Does it exist?");
+
+    struct stat file_stat;
+    if (fstat(stream_fd, &file_stat) == -1) {
+      close(stream_fd);
+      throw StreamException("MappedBinaryFileStream: Could not stat stream file");
+    }
+    map_size = file_stat.st_size;
+    if (map_size < header_size) {
+      close(stream_fd);
+      throw StreamException("MappedBinaryFileStream: Could not read header");
+    }
+
+    void* addr = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, stream_fd, 0);
+    close(stream_fd);  // the mapping remains valid after the fd is closed
+    if (addr == MAP_FAILED) {
+      perror("MappedBinaryFileStream");
+      throw StreamException("MappedBinaryFileStream: Could not map stream file");
+    }
+    map = static_cast<char*>(addr);
+
+    // hint to the kernel that we will mostly read front to back so it reads ahead aggressively
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    // read header from the mapping
+    memcpy(&num_vertices, map, sizeof(num_vertices));
+    memcpy(&num_edges, map + sizeof(num_vertices), sizeof(num_edges));
+
+    end_of_file = (num_edges * edge_size) + header_size;
+    if (end_of_file > map_size) {
+      munmap(map, map_size);
+      throw StreamException("MappedBinaryFileStream: Stream file is shorter than its header");
+    }
+
+    stream_off = header_size;
+    set_break_point(-1);
+  }
+
+  ~BasicMappedBinaryFileStream() { munmap(map, map_size); }
+
+  inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates) {
+    assert(upd_buf != nullptr);
+
+    size_t read_off;
+    size_t bytes_to_read = claim_bytes(num_updates, read_off);
+    size_t upds_read = bytes_to_read / edge_size;
+    Encoding::decode(reinterpret_cast<const record_t*>(map + read_off), upd_buf, upds_read);
+
+    if (upds_read < num_updates) {
+      GraphStreamUpdate& upd = upd_buf[upds_read];
+      upd.type = BREAKPOINT;
+      upd.edge = {0, 0};
+      return upds_read + 1;
+    }
+    return upds_read;
+  }
+
+  /**
+   * Claim the next updates of the stream without copying them.
+   * @param view         Set to point at the first claimed record within the mapped file. The view
+   *                     is read only and remains valid for the lifetime of this stream. Records
+   *                     are in the stream's encoding, e.g. CompactGraphStreamUpdate for a
+   *                     MappedCompactBinaryFileStream.
+   * @param num_updates  The maximum number of updates to claim.
+   * @return             The number of updates in the view. This is less than num_updates only if
+   *                     a break point was reached and is 0 if the break point was reached before
+   *                     any update could be claimed. A view never contains a BREAKPOINT update.
+   */
+  inline size_t get_update_view(const record_t** view, size_t num_updates) {
+    assert(view != nullptr);
+
+    size_t read_off;
+    size_t bytes_to_read = claim_bytes(num_updates, read_off);
+    *view = reinterpret_cast<const record_t*>(map + read_off);
+    return bytes_to_read / edge_size;
+  }
+
+  // get_update_buffer() and get_update_view() are thread safe
+  inline bool get_update_is_thread_safe() { return true; }
+
+  // the mapping is read only
+  inline void write_header(node_id_t, edge_id_t) {
+    throw StreamException("MappedBinaryFileStream: stream is read only!");
+  }
+  inline void write_updates(GraphStreamUpdate*, edge_id_t) {
+    throw StreamException("MappedBinaryFileStream: stream is read only!");
+  }
+
+  // seek to a position in the stream
+  inline void seek(edge_id_t edge_idx) {
+    stream_off = edge_idx * edge_size + header_size;
+  }
+
+  inline bool set_break_point(edge_id_t break_idx) {
+    edge_id_t byte_index = END_OF_STREAM;
+    if (break_idx != END_OF_STREAM) {
+      byte_index = header_size + break_idx * edge_size;
+    }
+    if (byte_index < stream_off) return false;
+    break_index = byte_index;
+    if (break_index > end_of_file) break_index = end_of_file;
+    return true;
+  }
+
+  inline void serialize_metadata(std::ostream& out) {
+    out << Encoding::mapped_stream_type << " " << file_name << std::endl;
+  }
+
+  static GraphStream* construct_from_metadata(std::istream& in) {
+    std::string file_name_from_stream;
+    in >> file_name_from_stream;
+    return new BasicMappedBinaryFileStream(file_name_from_stream);
+  }
+
+ private:
+  char* map;
+  size_t map_size;
+  edge_id_t end_of_file;
+  std::atomic<edge_id_t> stream_off;
+  std::atomic<edge_id_t> break_index;
+  const std::string file_name;
+
+  // size of binary encoded edge and the header
+  static constexpr size_t edge_size = sizeof(record_t);
+  static constexpr size_t header_size = sizeof(node_id_t) + sizeof(edge_id_t);
+
+  // claim up to num_updates updates from the stream, respecting the break point.
+  // Returns the number of claimed bytes, read_off is set to their offset within the mapping.
+  inline size_t claim_bytes(size_t num_updates, size_t& read_off) {
+    // many threads may execute this line simultaneously creating edge cases
+    size_t bytes_to_read = num_updates * edge_size;
+    read_off = stream_off.fetch_add(bytes_to_read, std::memory_order_relaxed);
+
+    // catch these edge cases here
+    if (read_off + bytes_to_read > break_index) {
+      bytes_to_read = read_off > break_index ? 0 : break_index - read_off;
+      stream_off = break_index.load();
+      if (bytes_to_read == 0) read_off = break_index;  // keep views within the mapping
+    }
+    assert(bytes_to_read % edge_size == 0);
+    return bytes_to_read;
+  }
+};
+
+typedef BasicMappedBinaryFileStream<PackedUpdateEncoding> MappedBinaryFileStream;
+typedef BasicMappedBinaryFileStream<CompactUpdateEncoding> MappedCompactBinaryFileStream;
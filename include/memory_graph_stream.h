@@ -0,0 +1,163 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+
+#include "graph_stream.h"
+
+// A stream held in memory, in one contiguous arena of GraphStreamUpdates. Reads, seeks and break
+// points behave as in BinaryFileStream and are thread safe, but no I/O is involved, which makes
+// it suited to measuring the throughput of consumers and to passing streams between components
+// of one process. The arena may be backed by huge pages to reduce TLB misses on large streams.
+//
+// The arena is filled by writing to it like any other stream, by load() from another stream, or
+// in place through data() by the generators.
+class MemoryGraphStream : public GraphStream {
+ public:
+  /**
+   * Create an empty MemoryGraphStream
+   * @param capacity    Number of updates to allocate the arena for. write_header() grows the
+   *                    arena when needed.
+   * @param huge_pages  If true, back the arena with huge pages. Explicit huge pages are used
+   *                    when the system has enough reserved, otherwise transparent huge pages are
+   *                    requested.
+   */
+  MemoryGraphStream(edge_id_t capacity = 0, bool huge_pages = false);
+  ~MemoryGraphStream();
+
+  MemoryGraphStream(const MemoryGraphStream &) = delete;
+  MemoryGraphStream &operator=(const MemoryGraphStream &) = delete;
+
+  inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates) {
+    assert(upd_buf != nullptr);
+
+    edge_id_t read_idx;
+    size_t upds_read = claim(num_updates, read_idx);
+    memcpy(upd_buf, arena + read_idx, upds_read * sizeof(GraphStreamUpdate));
+
+    if (upds_read < num_updates) {
+      GraphStreamUpdate& upd = upd_buf[upds_read];
+      upd.type = BREAKPOINT;
+      upd.edge = {0, 0};
+      return upds_read + 1;
+    }
+    return upds_read;
+  }
+
+  /**
+   * Claim the next updates of the stream without copying them.
+   * @param view         Set to point at the first claimed update within the arena. The view is
+   *                     valid until the arena is grown or the stream is destroyed.
+   * @param num_updates  The maximum number of updates to claim.
+   * @return             The number of updates in the view, less than num_updates only if the
+   *                     break point was reached. A view never contains a BREAKPOINT update.
+   */
+  inline size_t get_update_view(const GraphStreamUpdate** view, size_t num_updates) {
+    assert(view != nullptr);
+
+    edge_id_t read_idx;
+    size_t upds_read = claim(num_updates, read_idx);
+    *view = arena + read_idx;
+    return upds_read;
+  }
+
+  // read updates at an explicit update index, independent of the read position and break point.
+  // Thread safe. Returns the number of updates read, less than num_updates only at the end of
+  // the stream.
+  inline size_t read_updates_at(GraphStreamUpdate* upd_buf, edge_id_t num_updates,
+                                edge_id_t edge_idx) {
+    if (edge_idx >= num_edges) return 0;
+    num_updates = std::min(num_updates, num_edges - edge_idx);
+    memcpy(upd_buf, arena + edge_idx, num_updates * sizeof(GraphStreamUpdate));
+    return num_updates;
+  }
+
+  inline bool get_update_is_thread_safe() { return true; }
+
+  // set the number of vertices and updates of the stream and grow the arena to hold them. The
+  // contents of the arena are kept. Must not be called while other threads use the stream.
+  void write_header(node_id_t num_verts, edge_id_t num_edg);
+
+  // write updates after those written before. Thread safe, as BinaryFileStream::write_updates()
+  inline void write_updates(GraphStreamUpdate* upd, edge_id_t num_updates) {
+    write_updates_at(upd, num_updates, write_idx.fetch_add(num_updates));
+  }
+
+  // reserve the next num_updates updates for write_updates_at(). Thread safe.
+  inline edge_id_t reserve_updates(edge_id_t num_updates) {
+    return write_idx.fetch_add(num_updates);
+  }
+
+  // write updates at an explicit update index. Thread safe for disjoint ranges of the stream.
+  inline void write_updates_at(GraphStreamUpdate* upd, edge_id_t num_updates,
+                               edge_id_t edge_idx) {
+    if (edge_idx + num_updates > arena_capacity)
+      throw StreamException("MemoryGraphStream: write past the end of the arena");
+    memcpy(arena + edge_idx, upd, num_updates * sizeof(GraphStreamUpdate));
+  }
+
+  // seek to a position in the stream, for both reads and writes
+  inline void seek(edge_id_t edge_idx) {
+    stream_off = edge_idx;
+    write_idx = edge_idx;
+  }
+
+  inline bool set_break_point(edge_id_t break_idx) {
+    if (break_idx < stream_off) return false;
+    break_index = break_idx;
+    return true;
+  }
+
+  // the arena lives in the memory of this process and cannot be opened elsewhere
+  inline void serialize_metadata(std::ostream&) {
+    throw StreamException("MemoryGraphStream: stream cannot be serialized");
+  }
+
+  /*
+   * Replace the contents of this stream with the whole of another stream. Streams that can read
+   * at an update index (binary, compact binary, segmented and memory streams) and mapped ascii
+   * streams are loaded by num_threads threads in parallel, or one per hardware thread if 0.
+   * Other streams are read front to back by one thread. Ascii and other streams holding fewer
+   * updates than their header claims are truncated to the updates read. The read position and
+   * break point of src are reset.
+   */
+  void load(GraphStream* src, size_t num_threads = 0);
+
+  // the arena, for writing updates in place. Holds capacity() updates.
+  GraphStreamUpdate* data() { return arena; }
+  edge_id_t capacity() const { return arena_capacity; }
+  // is the arena backed by explicit huge pages
+  bool huge_page_backed() const { return huge_tlb; }
+
+ private:
+  GraphStreamUpdate* arena = nullptr;
+  edge_id_t arena_capacity = 0;
+  size_t arena_bytes = 0;  // size of the mapping
+  const bool huge_pages;
+  bool huge_tlb = false;
+
+  std::atomic<edge_id_t> stream_off{0};
+  std::atomic<edge_id_t> break_index{END_OF_STREAM};
+  std::atomic<edge_id_t> write_idx{0};
+
+  static constexpr size_t huge_page_size = size_t(1) << 21;
+  static constexpr edge_id_t load_chunk = 1 << 20;  // updates loaded by a thread at once
+
+  // replace the arena with one of at least capacity updates, keeping the contents
+  void grow(edge_id_t capacity);
+
+  // claim up to num_updates updates before the break point, as BinaryFileStream does. Returns
+  // the number claimed and sets read_idx to the index of the first.
+  inline size_t claim(size_t num_updates, edge_id_t& read_idx) {
+    edge_id_t off = stream_off.load(std::memory_order_relaxed);
+    edge_id_t claimed;
+    do {
+      edge_id_t limit = std::min(break_index.load(std::memory_order_relaxed), num_edges);
+      claimed = off >= limit ? 0 : std::min(edge_id_t(num_updates), limit - off);
+    } while (claimed > 0 && !stream_off.compare_exchange_weak(off, off + claimed,
+                                                              std::memory_order_relaxed));
+    read_idx = std::min(off, num_edges);  // keep views within the arena
+    return claimed;
+  }
+};
@@ -3,7 +3,7 @@
 #include <cmath>
 static const auto& hash = XXH3_64bits_withSeed;
 
-/* Permute the set of integers [0, 2^i]
+/* Permute the set of integers [0, n)
  *  uses XXH3 for hashing
  *  Uses Permute(L|R) = R|(L XOR H(R)) (input is split into two equal bit length subnumbers L,R)
  *  Compose Permute 3 times to get a pseudo-random permutation
@@ -21,6 +21,11 @@ static const auto& hash = XXH3_64bits_withSeed;
  *      * G splits the input into L|b|R
  *      * Both functions permute L and R as normal and compose the result with the ignored bit b
  *      * Compose H and G to create a pseudo-random permutation on odd bits
+ *
+ *  Arbitrary domain sizes n are supported by cycle-walking. The permutation is defined over
+ *  [0, 2^bits) where 2^bits is the smallest power of two >= n, and values >= n are permuted again
+ *  until they fall within [0, n). This is a permutation of [0, n) and as n > 2^bits / 2 the
+ *  expected number of walks is less than 2. If n is a power of two no walking is needed.
  */
 
 class PermutedSet {
@@ -34,7 +39,7 @@ class PermutedSet {
   size_t is_odd; // 1 if bits odd, 0 if even
 
   // Split is i = L | R | b
-  inline size_t H(size_t i, size_t h) {
+  inline size_t H(size_t i, size_t h) const {
     size_t L = i >> L_shift;
     size_t R = (i & HR_mask) >> is_odd;
     size_t b = is_odd & i;
@@ -48,7 +53,7 @@ class PermutedSet {
   }
 
   // Split is i = L | b | R
-  inline size_t G(size_t i, size_t h) {
+  inline size_t G(size_t i, size_t h) const {
     size_t L = i >> L_shift;
     size_t R = i & GR_mask;
     size_t b = i & Gb_mask;
@@ -61,21 +66,68 @@ class PermutedSet {
     return (L << L_shift) | R | b;
   }
 
+  // Inverses of H and G. The Feistel round i = L|R -> R|(L XOR H(R)) is undone by taking R from the
+  // top half and recovering L = (L XOR H(R)) XOR H(R).
+  inline size_t H_inverse(size_t i, size_t h) const {
+    size_t R = i >> L_shift;
+    size_t L_xor = (i & HR_mask) >> is_odd;
+    size_t b = is_odd & i;
+
+    size_t L = (hash(&R, sizeof(R), hash_seeds[h]) & GR_mask) ^ L_xor;
+    return (L << L_shift) | (R << is_odd) | b;
+  }
+
+  inline size_t G_inverse(size_t i, size_t h) const {
+    size_t R = i >> L_shift;
+    size_t L_xor = i & GR_mask;
+    size_t b = i & Gb_mask;
+
+    size_t L = (hash(&R, sizeof(R), hash_seeds[h]) & GR_mask) ^ L_xor;
+    return (L << L_shift) | R | b;
+  }
+
+  // the permutations of the power of two domain [0, 2^bits)
+  inline size_t permute_domain(size_t i) const { return H(G(i, 0), 1); }
+  inline size_t inverse_domain(size_t i) const { return G_inverse(H_inverse(i, 1), 0); }
+
  public:
   PermutedSet(size_t n, size_t seed) {
     hash_seeds[0] = seed * 3;
     hash_seeds[1] = hash_seeds[0] * 5;
 
-    size_t bits = ceil(log2(n));
+    size_t bits = 0;
+    while (bits < 64 && (size_t(1) << bits) < n) ++bits;
     is_odd = bits % 2 == 1;
-    
+    this->n = n;
+
     L_shift = (bits / 2) + is_odd;
-    HR_mask = (1 << ((bits / 2) + is_odd)) - 1;
-    GR_mask = (1 << (bits / 2)) - 1;
+    HR_mask = (size_t(1) << ((bits / 2) + is_odd)) - 1;
+    GR_mask = (size_t(1) << (bits / 2)) - 1;
     Gb_mask = (is_odd << (bits/2));
   }
 
-  size_t operator[](size_t i) {
-    return H(G(i, 0), 1);
+  size_t operator[](size_t i) const {
+    size_t x = permute_domain(i);
+    while (x >= n) x = permute_domain(x);
+    return x;
   }
+
+  // the index i such that (*this)[i] == x
+  size_t inverse(size_t x) const {
+    size_t i = inverse_domain(x);
+    while (i >= n) i = inverse_domain(i);
+    return i;
+  }
+
+  size_t size() const { return n; }
+
+  /*
+   * Permute many indices at once. Equivalent to out[j] = (*this)[in[j]] for j in [0, num) but
+   * evaluates the hash rounds of many indices together with an AVX-512 or AVX2 kernel when the
+   * cpu supports one (see src/permuted_set.cpp). The results are identical to operator[].
+   */
+  void permute_batch(const size_t *in, size_t *out, size_t num) const;
+
+  // Fill out with the permutation of the range of indices [begin, begin + num)
+  void permute_range(size_t begin, size_t num, size_t *out) const;
 };
@@ -0,0 +1,184 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "graph_stream.h"
+
+// A GraphStream decorator that reads ahead of the consumer. A background I/O thread keeps up to
+// num_batches batches of the wrapped stream buffered in a bounded ring so that storage latency
+// overlaps with the processing of updates instead of stalling the consumer.
+//
+// Break points are handled by the decorator itself, the wrapped stream is simply read until its
+// end. Therefore, break points must be registered with the PrefetchingGraphStream and not with
+// the stream it wraps.
+class PrefetchingGraphStream : public GraphStream {
+ public:
+  /**
+   * Create a PrefetchingGraphStream
+   * @param stream       The stream to read ahead of. Not owned, must outlive this object.
+   * @param batch_size   The number of updates requested from the wrapped stream per read.
+   * @param num_batches  The number of batches that may be buffered ahead of the consumer.
+   */
+  PrefetchingGraphStream(GraphStream* stream, size_t batch_size = 16384, size_t num_batches = 4)
+      : stream(stream), batch_size(batch_size), ring(num_batches) {
+    if (batch_size == 0 || num_batches == 0)
+      throw StreamException("PrefetchingGraphStream: batch_size and num_batches must be > 0");
+
+    num_vertices = stream->vertices();
+    num_edges = stream->edges();
+    for (auto& batch : ring) batch.updates.resize(batch_size);
+    start_prefetching();
+  }
+
+  ~PrefetchingGraphStream() { stop_prefetching(); }
+
+  inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates) {
+    assert(upd_buf != nullptr);
+    std::unique_lock<std::mutex> lk(ring_lock);
+
+    size_t upds_read = 0;
+    while (upds_read < num_updates && upd_offset < break_edge_idx) {
+      batch_ready.wait(lk, [&]() { return ring_count > 0 || prefetch_done; });
+      if (ring_count == 0) {
+        if (prefetch_error) std::rethrow_exception(prefetch_error);
+        break;  // reached the end of the wrapped stream
+      }
+
+      Batch& batch = ring[ring_head];
+      size_t to_copy = std::min(num_updates - upds_read, batch.size - batch.pos);
+      to_copy = std::min(to_copy, size_t(break_edge_idx - upd_offset));
+      memcpy(upd_buf + upds_read, batch.updates.data() + batch.pos,
+             to_copy * sizeof(GraphStreamUpdate));
+      batch.pos += to_copy;
+      upds_read += to_copy;
+      upd_offset += to_copy;
+
+      // release the batch to the I/O thread once it has been consumed
+      if (batch.pos == batch.size) {
+        ring_head = (ring_head + 1) % ring.size();
+        --ring_count;
+        batch_free.notify_one();
+      }
+    }
+
+    if (upds_read < num_updates) {
+      GraphStreamUpdate& upd = upd_buf[upds_read];
+      upd.type = BREAKPOINT;
+      upd.edge = {0, 0};
+      return upds_read + 1;
+    }
+    return upds_read;
+  }
+
+  // get_update_buffer() is thread safe, consumers are serialized on the ring
+  inline bool get_update_is_thread_safe() { return true; }
+
+  // discards all prefetched updates and restarts reading at edge_idx
+  inline void seek(edge_id_t edge_idx) {
+    stop_prefetching();
+    stream->seek(edge_idx);
+    upd_offset = edge_idx;
+    start_prefetching();
+  }
+
+  inline bool set_break_point(edge_id_t break_idx) {
+    std::lock_guard<std::mutex> lk(ring_lock);
+    if (break_idx < upd_offset) return false;
+    break_edge_idx = break_idx;
+    return true;
+  }
+
+  // remote readers do not need to prefetch through this process, so describe the wrapped stream
+  inline void serialize_metadata(std::ostream& out) { stream->serialize_metadata(out); }
+
+  // the decorator only reads
+  inline void write_header(node_id_t, edge_id_t) {
+    throw StreamException("PrefetchingGraphStream: stream is read only!");
+  }
+  inline void write_updates(GraphStreamUpdate*, edge_id_t) {
+    throw StreamException("PrefetchingGraphStream: stream is read only!");
+  }
+
+ private:
+  struct Batch {
+    std::vector<GraphStreamUpdate> updates;
+    size_t size = 0;  // number of valid updates in the batch
+    size_t pos = 0;   // number of updates already handed to the consumer
+  };
+
+  GraphStream* stream;
+  const size_t batch_size;
+
+  // bounded ring of batches. Batches [ring_head, ring_head + ring_count) are ready to consume.
+  std::vector<Batch> ring;
+  size_t ring_head = 0;
+  size_t ring_count = 0;
+  std::mutex ring_lock;
+  std::condition_variable batch_ready;
+  std::condition_variable batch_free;
+
+  std::thread io_thread;
+  bool stop_io = false;
+  bool prefetch_done = false;  // the I/O thread has read to the end of the wrapped stream
+  std::exception_ptr prefetch_error;
+
+  edge_id_t break_edge_idx = END_OF_STREAM;
+  edge_id_t upd_offset = 0;
+
+  void prefetch() {
+    try {
+      while (true) {
+        size_t slot;
+        {
+          std::unique_lock<std::mutex> lk(ring_lock);
+          batch_free.wait(lk, [&]() { return ring_count < ring.size() || stop_io; });
+          if (stop_io) return;
+          slot = (ring_head + ring_count) % ring.size();
+        }
+
+        // the slot is invisible to consumers until it is published, so read without the lock
+        Batch& batch = ring[slot];
+        size_t upds_read = stream->get_update_buffer(batch.updates.data(), batch_size);
+        bool end_of_stream = upds_read > 0 && batch.updates[upds_read - 1].type == BREAKPOINT;
+        if (end_of_stream) --upds_read;
+
+        std::lock_guard<std::mutex> lk(ring_lock);
+        batch.size = upds_read;
+        batch.pos = 0;
+        if (upds_read > 0) ++ring_count;
+        if (end_of_stream) prefetch_done = true;
+        batch_ready.notify_all();
+        if (end_of_stream) return;
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lk(ring_lock);
+      prefetch_error = std::current_exception();
+      prefetch_done = true;
+      batch_ready.notify_all();
+    }
+  }
+
+  void start_prefetching() {
+    ring_head = 0;
+    ring_count = 0;
+    stop_io = false;
+    prefetch_done = false;
+    prefetch_error = nullptr;
+    io_thread = std::thread(&PrefetchingGraphStream::prefetch, this);
+  }
+
+  void stop_prefetching() {
+    {
+      std::lock_guard<std::mutex> lk(ring_lock);
+      stop_io = true;
+    }
+    batch_free.notify_all();
+    if (io_thread.joinable()) io_thread.join();
+  }
+};
@@ -0,0 +1,143 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "graph_stream.h"
+
+// A GraphStream decorator that pauses all reading threads at a list of query indices.
+//
+// The queries are registered up front as break points of the wrapped stream. A reading thread
+// that reaches the next query waits in a barrier until all num_threads readers have arrived. By
+// then every reader has asked for more updates, so all updates before the query have been
+// processed. The last thread to arrive runs the query callback, registers the break point of
+// the following query and releases the others, which resume reading without ever seeing a
+// BREAKPOINT. Readers receive a BREAKPOINT only at the end of the stream.
+//
+// Exactly num_threads threads must read the stream until they receive the BREAKPOINT, otherwise
+// the barrier never completes. Break points are managed by the decorator, so set_break_point()
+// must not be called on it or on the wrapped stream.
+class QueryBarrierStream : public GraphStream {
+ public:
+  using QueryCallback = std::function<void(edge_id_t query_idx)>;
+
+  /**
+   * Create a QueryBarrierStream
+   * @param stream         The stream to read. Not owned, must outlive this object. Its
+   *                       get_update_buffer() must be thread safe if num_threads > 1, and it
+   *                       must not have been read past the first query.
+   * @param query_indices  Strictly increasing stream indices at which to run a query. A query
+   *                       at index q runs after updates [0, q) have been processed.
+   * @param num_threads    The number of threads reading the stream.
+   * @param on_query       Called once per query by the last thread to reach it, while all
+   *                       other readers wait. Exceptions are rethrown in every reader.
+   */
+  QueryBarrierStream(GraphStream* stream, std::vector<edge_id_t> query_indices,
+                     size_t num_threads, QueryCallback on_query)
+      : stream(stream),
+        queries(std::move(query_indices)),
+        num_threads(num_threads),
+        on_query(std::move(on_query)) {
+    if (num_threads == 0) throw StreamException("QueryBarrierStream: num_threads must be > 0");
+    if (num_threads > 1 && !stream->get_update_is_thread_safe())
+      throw StreamException("QueryBarrierStream: wrapped stream is not thread safe");
+    for (size_t i = 0; i < queries.size(); i++) {
+      if (queries[i] > stream->edges())
+        throw StreamException("QueryBarrierStream: query index past the end of the stream");
+      if (i > 0 && queries[i] <= queries[i - 1])
+        throw StreamException("QueryBarrierStream: query indices must be strictly increasing");
+    }
+
+    num_vertices = stream->vertices();
+    num_edges = stream->edges();
+    register_next_query();
+  }
+
+  inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates) {
+    assert(upd_buf != nullptr);
+    while (true) {
+      size_t upds_read = stream->get_update_buffer(upd_buf, num_updates);
+      bool at_break = upds_read > 0 && upd_buf[upds_read - 1].type == BREAKPOINT;
+      if (!at_break) return upds_read;
+
+      // hand out the updates before the break first, the query waits until they are processed
+      if (upds_read > 1) return upds_read - 1;
+      if (!wait_for_query()) return upds_read;  // end of the stream
+    }
+  }
+
+  inline bool get_update_is_thread_safe() { return stream->get_update_is_thread_safe(); }
+
+  // restart reading at edge_idx with the first query at or after it. Must not be called while
+  // other threads read.
+  inline void seek(edge_id_t edge_idx) {
+    std::lock_guard<std::mutex> lk(barrier_lock);
+    stream->set_break_point(END_OF_STREAM);
+    stream->seek(edge_idx);
+    next_query = std::lower_bound(queries.begin(), queries.end(), edge_idx) - queries.begin();
+    register_next_query();
+  }
+
+  // break points are the queries registered at construction
+  inline bool set_break_point(edge_id_t) { return false; }
+
+  inline void serialize_metadata(std::ostream& out) { stream->serialize_metadata(out); }
+
+  // the decorator only reads
+  inline void write_header(node_id_t, edge_id_t) {
+    throw StreamException("QueryBarrierStream: stream is read only!");
+  }
+  inline void write_updates(GraphStreamUpdate*, edge_id_t) {
+    throw StreamException("QueryBarrierStream: stream is read only!");
+  }
+
+ private:
+  GraphStream* stream;
+  const std::vector<edge_id_t> queries;
+  const size_t num_threads;
+  const QueryCallback on_query;
+
+  size_t next_query = 0;  // index in queries of the registered break point
+
+  std::mutex barrier_lock;
+  std::condition_variable barrier_done;
+  size_t num_arrived = 0;
+  size_t generation = 0;  // number of completed barriers
+  std::exception_ptr query_error;
+
+  // set the break point of the wrapped stream to the next query, or to its end
+  void register_next_query() {
+    edge_id_t break_idx = next_query < queries.size() ? queries[next_query] : END_OF_STREAM;
+    if (!stream->set_break_point(break_idx))
+      throw StreamException("QueryBarrierStream: could not set break point of wrapped stream");
+  }
+
+  // wait until all threads reached the current query and it has run. Returns false if there
+  // is no query left, meaning the thread is at the end of the stream.
+  bool wait_for_query() {
+    std::unique_lock<std::mutex> lk(barrier_lock);
+    if (next_query == queries.size()) return false;
+
+    size_t my_generation = generation;
+    if (++num_arrived == num_threads) {
+      try {
+        on_query(queries[next_query]);
+        ++next_query;
+        register_next_query();
+      } catch (...) {
+        query_error = std::current_exception();
+      }
+      num_arrived = 0;
+      ++generation;
+      barrier_done.notify_all();
+    } else {
+      barrier_done.wait(lk, [&]() { return generation != my_generation; });
+    }
+    if (query_error) std::rethrow_exception(query_error);
+    return true;
+  }
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Run f(i) for i in [0, num_threads) on a thread each and wait for all of them. An exception
+// thrown by f, such as a failed write, is rethrown to the caller once every thread has finished,
+// instead of terminating the process. If several threads throw, the first by index is rethrown.
+template <typename Func>
+void run_threads(size_t num_threads, Func f) {
+  std::vector<std::exception_ptr> exceptions(num_threads);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; i++) {
+    threads.emplace_back([&, i]() {
+      try {
+        f(i);
+      } catch (...) {
+        exceptions[i] = std::current_exception();
+      }
+    });
+  }
+  for (auto &thr : threads) thr.join();
+  for (auto &e : exceptions)
+    if (e) std::rethrow_exception(e);
+}
@@ -0,0 +1,253 @@
+#pragma once
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "binary_file_stream.h"
+#include "graph_stream.h"
+
+// A binary stream split into segment files, each a BinaryFileStream holding a contiguous range of
+// the updates, described by a text manifest:
+//
+//   num_vertices num_edges num_segments
+//   num_updates segment_file    (one line per segment, in stream order)
+//
+// Relative segment file names are relative to the directory of the manifest, so a stream can be
+// moved as a directory, while absolute names let segments live on different disks. The stream is
+// indexed globally: seek(), set_break_point() and the update indices of reads and writes refer to
+// the whole stream. Every segment has its own file descriptor, so threads reading or writing
+// different ranges of the stream use different files. Segments are opened when they are first
+// accessed, so a reader constructed from serialized metadata only opens the segments it reads.
+class SegmentedFileStream : public GraphStream {
+ public:
+  /**
+   * Open a SegmentedFileStream for reading
+   * @param manifest_file  Name of the manifest of the stream.
+   */
+  SegmentedFileStream(std::string manifest_file)
+      : manifest_file(manifest_file), read_only(true), segment_updates(0) {
+    std::ifstream manifest(manifest_file);
+    size_t segment_count;
+    if (!(manifest >> num_vertices >> num_edges >> segment_count))
+      throw StreamException("SegmentedFileStream: Could not read manifest " + manifest_file);
+
+    edge_id_t first = 0;
+    for (size_t k = 0; k < segment_count; k++) {
+      std::unique_ptr<Segment> seg(new Segment());
+      if (!(manifest >> seg->size) || !std::getline(manifest >> std::ws, seg->file_name))
+        throw StreamException("SegmentedFileStream: Could not read segment " +
+                              std::to_string(k) + " of manifest " + manifest_file);
+      seg->first = first;
+      first += seg->size;
+      segments.push_back(std::move(seg));
+    }
+    if (first != num_edges)
+      throw StreamException("SegmentedFileStream: Segments of manifest " + manifest_file +
+                            " do not add up to the number of updates");
+    set_break_point(END_OF_STREAM);
+  }
+
+  /**
+   * Create a SegmentedFileStream for writing. The segments are laid out by write_header().
+   * @param manifest_file    Name of the manifest of the stream.
+   * @param segment_updates  The number of updates in every segment but the last.
+   * @param segment_dirs     Directories in which to place the segments, round robin. Relative
+   *                         directories are relative to the directory of the manifest. By
+   *                         default the segments are placed next to the manifest.
+   */
+  SegmentedFileStream(std::string manifest_file, edge_id_t segment_updates,
+                      std::vector<std::string> segment_dirs = {})
+      : manifest_file(manifest_file),
+        read_only(false),
+        segment_updates(segment_updates),
+        segment_dirs(segment_dirs) {
+    if (segment_updates == 0)
+      throw StreamException("SegmentedFileStream: segment_updates must be > 0");
+    set_break_point(END_OF_STREAM);
+  }
+
+  inline size_t get_update_buffer(GraphStreamUpdate* upd_buf, size_t num_updates) {
+    assert(upd_buf != nullptr);
+
+    // claim a range of the stream before the break point, as BinaryFileStream does
+    edge_id_t off = stream_off.load(std::memory_order_relaxed);
+    edge_id_t upds_read;
+    do {
+      edge_id_t limit = std::min(break_index.load(std::memory_order_relaxed), num_edges);
+      upds_read = off >= limit ? 0 : std::min(edge_id_t(num_updates), limit - off);
+    } while (upds_read > 0 && !stream_off.compare_exchange_weak(off, off + upds_read,
+                                                                std::memory_order_relaxed));
+    read_updates_at(upd_buf, upds_read, off);
+
+    if (upds_read < num_updates) {
+      GraphStreamUpdate& upd = upd_buf[upds_read];
+      upd.type = BREAKPOINT;
+      upd.edge = {0, 0};
+      return upds_read + 1;
+    }
+    return upds_read;
+  }
+
+  // read updates at a global update index, independent of the read position and break point.
+  // Thread safe. Returns the number of updates read, which is less than num_updates only at the
+  // end of the stream.
+  inline size_t read_updates_at(GraphStreamUpdate* upd_buf, edge_id_t num_updates,
+                                edge_id_t edge_idx) {
+    if (edge_idx >= num_edges) return 0;
+    num_updates = std::min(num_updates, num_edges - edge_idx);
+    for_each_segment(num_updates, edge_idx, [&](Segment& seg, edge_id_t done, edge_id_t num) {
+      if (seg.stream->read_updates_at(upd_buf + done, num, edge_idx + done - seg.first) != num)
+        throw StreamException("SegmentedFileStream: Segment " + seg.file_name + " is too short");
+    });
+    return num_updates;
+  }
+
+  inline bool get_update_is_thread_safe() { return true; }
+
+  // lay out the segments for num_edg updates and write the manifest and segment headers. Segment
+  // boundaries depend only on segment_updates, so the header may be rewritten with a different
+  // number of updates after writing, such as the number actually written. Segments no longer
+  // needed are removed. Must not be called while other threads use the stream.
+  inline void write_header(node_id_t num_verts, edge_id_t num_edg) {
+    if (read_only) throw StreamException("SegmentedFileStream: stream not open for writing!");
+
+    size_t segment_count = (num_edg + segment_updates - 1) / segment_updates;
+    for (size_t k = segment_count; k < segments.size(); k++) {
+      segments[k]->stream.reset();
+      unlink(resolve(segments[k]->file_name).c_str());
+    }
+    segments.resize(std::min(segments.size(), segment_count));
+
+    while (segments.size() < segment_count) {
+      size_t k = segments.size();
+      std::unique_ptr<Segment> seg(new Segment());
+      std::string name = base_name() + ".seg" + std::to_string(k);
+      seg->file_name = segment_dirs.empty() ? name : segment_dirs[k % segment_dirs.size()] +
+                                                         "/" + name;
+      seg->first = k * segment_updates;
+      segments.push_back(std::move(seg));
+    }
+    for (auto& seg : segments) {
+      seg->size = std::min(segment_updates, num_edg - seg->first);
+      open_segment(*seg).stream->write_header(num_verts, seg->size);
+    }
+
+    std::ofstream manifest(manifest_file, std::ios::trunc);
+    manifest << num_verts << " " << num_edg << " " << segments.size() << std::endl;
+    for (auto& seg : segments) manifest << seg->size << " " << seg->file_name << std::endl;
+    if (!manifest)
+      throw StreamException("SegmentedFileStream: Could not write manifest " + manifest_file);
+
+    num_vertices = num_verts;
+    num_edges = num_edg;
+    stream_off = 0;
+    write_off = 0;
+  }
+
+  // write updates after those written before. Thread safe, see BinaryFileStream::write_updates()
+  inline void write_updates(GraphStreamUpdate* upd, edge_id_t num_updates) {
+    write_updates_at(upd, num_updates, write_off.fetch_add(num_updates));
+  }
+
+  // write updates at a global update index. Thread safe for disjoint ranges of the stream.
+  inline void write_updates_at(GraphStreamUpdate* upd, edge_id_t num_updates,
+                               edge_id_t edge_idx) {
+    if (read_only) throw StreamException("SegmentedFileStream: stream not open for writing!");
+    if (edge_idx + num_updates > num_edges)
+      throw StreamException("SegmentedFileStream: write past the end of the stream");
+    for_each_segment(num_updates, edge_idx, [&](Segment& seg, edge_id_t done, edge_id_t num) {
+      seg.stream->write_updates_at(upd + done, num, edge_idx + done - seg.first);
+    });
+  }
+
+  // seek to a position in the stream, for both reads and writes
+  inline void seek(edge_id_t edge_idx) {
+    stream_off = edge_idx;
+    write_off = edge_idx;
+  }
+
+  inline bool set_break_point(edge_id_t break_idx) {
+    if (break_idx < stream_off) return false;
+    break_index = break_idx;
+    return true;
+  }
+
+  inline void serialize_metadata(std::ostream& out) {
+    out << SegmentedFile << " " << manifest_file << std::endl;
+  }
+
+  static GraphStream* construct_from_metadata(std::istream& in) {
+    std::string manifest_file_from_stream;
+    in >> manifest_file_from_stream;
+    return new SegmentedFileStream(manifest_file_from_stream);
+  }
+
+  size_t num_segments() const { return segments.size(); }
+
+ private:
+  struct Segment {
+    edge_id_t first = 0;  // global index of the first update
+    edge_id_t size = 0;
+    std::string file_name;  // as written in the manifest
+    std::once_flag opened;
+    std::unique_ptr<BinaryFileStream> stream;
+  };
+
+  const std::string manifest_file;
+  const bool read_only;
+  const edge_id_t segment_updates;  // when writing
+  const std::vector<std::string> segment_dirs;
+  std::vector<std::unique_ptr<Segment>> segments;
+
+  std::atomic<edge_id_t> stream_off{0};
+  std::atomic<edge_id_t> break_index{END_OF_STREAM};
+  std::atomic<edge_id_t> write_off{0};
+
+  // the file name of the manifest without its directory
+  std::string base_name() const {
+    size_t pos = manifest_file.find_last_of('/');
+    return pos == std::string::npos ? manifest_file : manifest_file.substr(pos + 1);
+  }
+
+  // the path of a segment file named in the manifest
+  std::string resolve(const std::string& file_name) const {
+    size_t pos = manifest_file.find_last_of('/');
+    if (file_name[0] == '/' || pos == std::string::npos) return file_name;
+    return manifest_file.substr(0, pos + 1) + file_name;
+  }
+
+  // open the stream of a segment if it is not open yet. Thread safe.
+  Segment& open_segment(Segment& seg) {
+    std::call_once(seg.opened, [&]() {
+      seg.stream.reset(new BinaryFileStream(resolve(seg.file_name), read_only));
+      if (read_only && seg.stream->edges() != seg.size)
+        throw StreamException("SegmentedFileStream: Segment " + seg.file_name +
+                              " does not match the manifest");
+    });
+    return seg;
+  }
+
+  // call f(segment, done, num) for each segment overlapping the num_updates updates starting at
+  // edge_idx, where [done, done + num) is the part of the range within the segment
+  template <typename Func>
+  void for_each_segment(edge_id_t num_updates, edge_id_t edge_idx, Func f) {
+    auto it = std::upper_bound(segments.begin(), segments.end(), edge_idx,
+                               [](edge_id_t idx, const std::unique_ptr<Segment>& seg) {
+                                 return idx < seg->first;
+                               });
+    size_t k = it - segments.begin() - 1;
+    for (edge_id_t done = 0; done < num_updates; k++) {
+      Segment& seg = open_segment(*segments[k]);
+      edge_id_t num = std::min(num_updates - done, seg.first + seg.size - (edge_idx + done));
+      if (num > 0) f(seg, done, num);
+      done += num;
+    }
+  }
+};
@@ -2,27 +2,44 @@
 #include <graph_zeppelin_common.h>
 #include "permuted_set.h"
 #include "graph_stream.h"
+#include "memory_graph_stream.h"
 
 class StaticErdosGenerator {
  private:
   node_id_t num_vertices;
   double density;
   size_t seed;
+  size_t num_pairs;  // number of distinct vertex pairs
   edge_id_t total_edges;
   PermutedSet permute;
 
   edge_id_t edge_idx = 0;
-  edge_id_t skip = 0;
-  size_t v_bits;
+
+  static constexpr size_t edge_chunk = 1 << 20;  // edges generated by a thread at once
+  static constexpr size_t permute_batch_size = 1024;  // pairs permuted at once
+
  public:
   StaticErdosGenerator(size_t seed, node_id_t num_vertices, double density);
 
   // these functions write all the stream edges to a file
-  void to_binary_file(std::string file_name);
+  // to_binary_file generates and writes the stream in parallel, with num_threads threads or one
+  // per hardware thread if 0. The file is identical for any number of threads.
+  void to_binary_file(std::string file_name, size_t num_threads = 0);
+  void to_compact_binary_file(std::string file_name);  // at most 2^31 vertices
   void to_ascii_file(std::string file_name);
+  // generates the stream in parallel directly into the arena of a MemoryGraphStream
+  void to_memory_stream(MemoryGraphStream &stream, size_t num_threads = 0);
 
   GraphStreamUpdate get_next_edge();
 
+  /*
+   * The stream is a random permutation of the vertex pairs, truncated to the number of edges.
+   * Get the edges with stream indices [begin, end). This is independent of get_next_edge() and
+   * thread safe.
+   * @param upds   Buffer of at least end - begin updates to place the edges in.
+   */
+  void get_edges(edge_id_t begin, edge_id_t end, GraphStreamUpdate *upds) const;
+
   // getters
   node_id_t get_num_vertices() { return num_vertices; }
   edge_id_t get_num_edges() { return total_edges; }
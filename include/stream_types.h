@@ -32,10 +32,24 @@ struct GraphStreamUpdate {
 };
 #pragma pack(pop)
 
+// Compact 8 byte alternative to GraphStreamUpdate for graphs with at most 2^31 vertices.
+// The update type lives in the top bit of src, so updates are naturally aligned.
+struct CompactGraphStreamUpdate {
+  uint32_t src_type;
+  uint32_t dst;
+};
+static_assert(sizeof(CompactGraphStreamUpdate) == 8, "CompactGraphStreamUpdate must be 8 bytes");
+
 static constexpr edge_id_t END_OF_STREAM = (edge_id_t) -1;
 
 // Enum that defines the types of streams
 enum StreamType {
   BinaryFile,
   AsciiFile,
+  MappedBinaryFile,
+  CompressedBinaryFile,
+  MappedAsciiFile,
+  CompactBinaryFile,
+  MappedCompactBinaryFile,
+  SegmentedFile,
 };
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstring>
+
+#include "graph_stream.h"
+
+// Encodings of updates within binary stream files. A binary stream class is templated upon one
+// of these traits, which select the on-disk record type at compile time.
+//
+// Each encoding defines
+//   record_t:            the on-disk and in-memory record of one update
+//   binary_stream_type:  StreamType of a BinaryFileStream of this encoding
+//   mapped_stream_type:  StreamType of a MappedBinaryFileStream of this encoding
+//   check_vertices():    throws if a graph of this many vertices cannot be encoded
+//   encode() / decode(): convert between records and GraphStreamUpdates
+//   decode_in_place():   decode num records stored at the end of a buffer of num updates, that
+//                        is, starting num * (sizeof(GraphStreamUpdate) - sizeof(record_t)) bytes
+//                        into the buffer. This lets streams read records straight into the
+//                        caller's buffer.
+
+// The original encoding, a packed GraphStreamUpdate of 9 bytes
+struct PackedUpdateEncoding {
+  typedef GraphStreamUpdate record_t;
+  static constexpr StreamType binary_stream_type = BinaryFile;
+  static constexpr StreamType mapped_stream_type = MappedBinaryFile;
+
+  static inline void check_vertices(node_id_t) {}
+
+  static inline void encode(const GraphStreamUpdate* upds, record_t* records, size_t num) {
+    memcpy(records, upds, num * sizeof(record_t));
+  }
+  static inline void decode(const record_t* records, GraphStreamUpdate* upds, size_t num) {
+    memcpy(upds, records, num * sizeof(record_t));
+  }
+  static inline void decode_in_place(GraphStreamUpdate*, size_t) {}
+};
+
+// An aligned 8 byte encoding for graphs with at most 2^31 vertices. See CompactGraphStreamUpdate
+struct CompactUpdateEncoding {
+  typedef CompactGraphStreamUpdate record_t;
+  static constexpr StreamType binary_stream_type = CompactBinaryFile;
+  static constexpr StreamType mapped_stream_type = MappedCompactBinaryFile;
+  static constexpr uint32_t type_bit = uint32_t(1) << 31;
+
+  static inline void check_vertices(node_id_t num_vertices) {
+    if (uint64_t(num_vertices) > uint64_t(type_bit))
+      throw StreamException("CompactUpdateEncoding: graphs may have at most 2^31 vertices");
+  }
+
+  static inline record_t encode(const GraphStreamUpdate& upd) {
+    if (uint64_t(upd.edge.src) >= type_bit || uint64_t(upd.edge.dst) >= type_bit)
+      throw StreamException("CompactUpdateEncoding: vertex id does not fit in 31 bits");
+    return {uint32_t(upd.edge.src) | (upd.type == DELETE ? type_bit : 0), uint32_t(upd.edge.dst)};
+  }
+  static inline GraphStreamUpdate decode(const record_t& record) {
+    return {uint8_t(record.src_type >> 31), {node_id_t(record.src_type & ~type_bit), record.dst}};
+  }
+
+  static inline void encode(const GraphStreamUpdate* upds, record_t* records, size_t num) {
+    for (size_t i = 0; i < num; i++) records[i] = encode(upds[i]);
+  }
+  static inline void decode(const record_t* records, GraphStreamUpdate* upds, size_t num) {
+    for (size_t i = 0; i < num; i++) upds[i] = decode(records[i]);
+  }
+  // update i overwrites bytes [9i, 9i + 9) which never reach record i + 1 at byte num + 8(i + 1)
+  static inline void decode_in_place(GraphStreamUpdate* upds, size_t num) {
+    const char* records = (const char*)upds + num * (sizeof(GraphStreamUpdate) - sizeof(record_t));
+    for (size_t i = 0; i < num; i++) {
+      record_t record;
+      memcpy(&record, records + i * sizeof(record_t), sizeof(record_t));
+      upds[i] = decode(record);
+    }
+  }
+};
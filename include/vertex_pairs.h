@@ -0,0 +1,27 @@
+#pragma once
+#include <algorithm>
+
+#include "stream_types.h"
+
+// Number of distinct pairs of vertices (edges without self loops) in a graph
+inline size_t num_vertex_pairs(node_id_t num_vertices) {
+  return num_vertices < 2 ? 0 : size_t(num_vertices) * (num_vertices - 1) / 2;
+}
+
+// Map a pair index k in [0, num_vertex_pairs(num_vertices)) to a distinct pair of vertices with
+// src < dst. The index enumerates the pairs of the circulant decomposition of the complete graph:
+// each vertex a is paired with a + d (mod V) for every distance d in [1, (V-1)/2]. If V is even
+// the pairs at distance V/2 are enumerated once, from the vertices a < V/2.
+inline Edge vertex_pair(node_id_t num_vertices, size_t k) {
+  size_t max_dist = (num_vertices - 1) / 2;
+  size_t a, d;
+  if (k < num_vertices * max_dist) {
+    a = k % num_vertices;
+    d = k / num_vertices + 1;
+  } else {
+    a = k - num_vertices * max_dist;
+    d = num_vertices / 2;
+  }
+  size_t b = (a + d) % num_vertices;
+  return {node_id_t(std::min(a, b)), node_id_t(std::max(a, b))};
+}
@@ -4,19 +4,17 @@
 #include <cmath>
 #include <fstream>
 #include <iostream>
-#include <random>
+#include <thread>
 #include <vector>
 
 #include "ascii_file_stream.h"
 #include "binary_file_stream.h"
+#include "buffered_output_stream.h"
+#include "run_threads.h"
+#include "vertex_pairs.h"
 
-DynamicErdosGenerator::DynamicErdosGenerator(size_t seed, node_id_t num_vertices, double density,
-                                             double portion_delete, double portion_adtl,
-                                             size_t rounds)
-    : num_vertices(num_vertices),
-      seed(seed),
-      total_edges(num_vertices * (num_vertices - 1) / 2 * density),
-      density(density) {
+double DynamicErdosGenerator::check_parameters(double density, double portion_delete,
+                                               double portion_adtl, size_t rounds) {
   // Ensure the density and stream_vary parameters are in bounds
   if (density <= 0 || density > 1) {
     throw StreamException("DynamicErdosGenerator: Density out of range (0, 1]");
@@ -30,111 +28,151 @@ DynamicErdosGenerator::DynamicErdosGenerator(size_t seed, node_id_t num_vertices
   if (rounds == 0 && (portion_adtl > 0 || portion_delete > 0)) {
     throw StreamException("DynamicErdosGenerator: round must be > 0 if adtl or delete > 0");
   }
+  return density;
+}
 
-  // create a random number generator
-  std::mt19937_64 gen(seed);
-
-  // Generate set of all possible edges
-  std::vector<Edge> all_edges;
-  all_edges.reserve(num_vertices * (num_vertices - 1) / 2);
-  for (node_id_t i = 0; i < num_vertices; i++)
-    for (node_id_t j = i + 1; j < num_vertices; j++) all_edges.push_back({i, j});
-
-  // Permute the set of all possible edges
-  std::shuffle(all_edges.begin(), all_edges.end(), gen);
-
-  // begin constructing stream updates vector
-  updates.reserve(total_edges + 2 * rounds * total_edges * portion_delete +
-                  2 * rounds * (all_edges.size() - total_edges) * portion_adtl);
-  true_edges.reserve(total_edges);
-  for (edge_id_t i = 0; i < total_edges; i++) {
-    updates.push_back({INSERT, all_edges[i]});
-    true_edges.push_back(all_edges[i]);
-  }
-  for (size_t r = 0; r < rounds; r++) {
-    // delete and reinsert final
-    for (edge_id_t i = 0; i < total_edges * portion_delete; i++) {
-      updates.push_back({INSERT, all_edges[i]});
-      updates.push_back({INSERT, all_edges[i]});
-    }
-    // insert and delete not final
-    for (edge_id_t i = 0; i < (all_edges.size() - total_edges) * portion_adtl; i++) {
-      updates.push_back({INSERT, all_edges[total_edges + i]});
-      updates.push_back({INSERT, all_edges[total_edges + i]});
-    }
-  }
+DynamicErdosGenerator::DynamicErdosGenerator(size_t seed, node_id_t num_vertices, double density,
+                                             double portion_delete, double portion_adtl,
+                                             size_t rounds)
+    : num_vertices(num_vertices),
+      seed(seed),
+      density(check_parameters(density, portion_delete, portion_adtl, rounds)),
+      num_pairs(num_vertex_pairs(num_vertices)),
+      num_true(num_pairs * density),
+      num_reinserted(std::ceil(num_true * portion_delete)),
+      num_adtl(std::ceil((num_pairs - num_true) * portion_adtl)),
+      rounds(rounds),
+      total_edges(num_true + 2 * rounds * (num_reinserted + num_adtl)),
+      edge_permute(num_pairs, seed),
+      update_permute(total_edges, hash(&seed, sizeof(seed), 0)) {}
+
+size_t DynamicErdosGenerator::edge_of(size_t canonical) const {
+  if (canonical < num_true) return canonical;
+  canonical -= num_true;
+  if (canonical < 2 * rounds * num_reinserted) return canonical % num_reinserted;
+  canonical -= 2 * rounds * num_reinserted;
+  return num_true + canonical % num_adtl;
+}
 
-  // set total edges to include extra inserts and deletes
-  total_edges = updates.size();
+size_t DynamicErdosGenerator::num_occurrences(size_t edge_rank) const {
+  if (edge_rank < num_reinserted) return 2 * rounds + 1;
+  if (edge_rank < num_true) return 1;
+  return 2 * rounds;
+}
 
-  // shuffle the updates
-  std::shuffle(updates.begin(), updates.end(), gen);
+size_t DynamicErdosGenerator::occurrence(size_t edge_rank, size_t k) const {
+  if (edge_rank < num_true)
+    return k == 0 ? edge_rank : num_true + (k - 1) * num_reinserted + edge_rank;
+  return num_true + 2 * rounds * num_reinserted + k * num_adtl + (edge_rank - num_true);
+}
 
-  // set the update type appropriately
-  // 1. Build adjacency matrix
-  std::vector<std::vector<bool>> adj_mat(num_vertices);
-  for (node_id_t i = 0; i < num_vertices; i++) {
-    adj_mat[i] = std::vector<bool>(num_vertices - i - 1, false);
-  }
-  // 2. Actually set the types
-  for (auto &upd : updates) {
-    node_id_t src = std::min(upd.edge.src, upd.edge.dst);
-    node_id_t local_dst = std::max(upd.edge.src, upd.edge.dst) - src - 1;
-    if (adj_mat[src][local_dst]) {
-      upd.type = DELETE;
-    } else {
-      upd.type = INSERT;
-    }
-    adj_mat[src][local_dst] = !adj_mat[src][local_dst];
+GraphStreamUpdate DynamicErdosGenerator::make_update(edge_id_t stream_idx, size_t canonical) const {
+  // updates to an edge alternate between insertions and deletions, so the type is the parity of
+  // the number of updates to the same edge earlier in the stream
+  size_t edge_rank = edge_of(canonical);
+  size_t num_occ = num_occurrences(edge_rank);
+  size_t earlier = 0;
+  for (size_t k = 0; k < num_occ; k++) {
+    size_t other = occurrence(edge_rank, k);
+    if (other != canonical && update_permute.inverse(other) < stream_idx) ++earlier;
   }
+  UpdateType type = earlier % 2 == 0 ? INSERT : DELETE;
+  return {type, vertex_pair(num_vertices, edge_permute[edge_rank])};
 }
 
 void write_to_file(GraphStream *stream, DynamicErdosGenerator &gen) {
+  // the updates are written on a background thread while the next ones are generated
+  BufferedOutputStream output(stream);
   size_t buffer_capacity = 4096;
   GraphStreamUpdate upds[buffer_capacity];
   size_t buffer_size = 0;
-  stream->write_header(gen.get_num_vertices(), gen.get_num_edges());
+  output.write_header(gen.get_num_vertices(), gen.get_num_edges());
 
   for (edge_id_t i = 0; i < gen.get_num_edges(); i++) {
     upds[buffer_size++] = gen.get_next_edge();
     if (buffer_size >= buffer_capacity) {
-      stream->write_updates(upds, buffer_size);
+      output.write_updates(upds, buffer_size);
       buffer_size = 0;
     }
   }
   if (buffer_size > 0) {
-    stream->write_updates(upds, buffer_size);
+    output.write_updates(upds, buffer_size);
   }
+  output.close();
 }
 
-void DynamicErdosGenerator::to_binary_file(std::string file_name) {
-  edge_idx = 0;
+void DynamicErdosGenerator::to_binary_file(std::string file_name, size_t num_threads) {
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
   BinaryFileStream output_stream(file_name, false);
+  output_stream.write_header(num_vertices, total_edges);
+
+  // each thread generates chunks of the stream and writes them at their position in the file
+  size_t num_chunks = (total_edges + update_chunk - 1) / update_chunk;
+  run_threads(num_threads, [&](size_t t) {
+    std::vector<GraphStreamUpdate> upds(update_chunk);
+    for (size_t c = t; c < num_chunks; c += num_threads) {
+      edge_id_t begin = c * update_chunk;
+      edge_id_t end = std::min(total_edges, begin + update_chunk);
+      get_updates(begin, end, upds.data());
+      output_stream.write_updates_at(upds.data(), end - begin, begin);
+    }
+  });
+}
+
+void DynamicErdosGenerator::to_memory_stream(MemoryGraphStream &stream, size_t num_threads) {
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  stream.write_header(num_vertices, total_edges);
+  size_t num_chunks = (total_edges + update_chunk - 1) / update_chunk;
+  run_threads(num_threads, [&](size_t t) {
+    for (size_t c = t; c < num_chunks; c += num_threads) {
+      edge_id_t begin = c * update_chunk;
+      edge_id_t end = std::min(total_edges, begin + update_chunk);
+      get_updates(begin, end, stream.data() + begin);
+    }
+  });
+}
+void DynamicErdosGenerator::to_compact_binary_file(std::string file_name) {
+  edge_idx = 0;
+  CompactBinaryFileStream output_stream(file_name, false);
   write_to_file(&output_stream, *this);
 }
 void DynamicErdosGenerator::to_ascii_file(std::string file_name) {
   edge_idx = 0;
-  AsciiFileStream output_stream(file_name, true);
+  AsciiFileStream output_stream(file_name, true, std::thread::hardware_concurrency());
   write_to_file(&output_stream, *this);
+  output_stream.close();
 }
 void DynamicErdosGenerator::write_cumulative_file(std::string file_name) {
   AsciiFileStream output_stream(file_name, false);
 
-  size_t buffer_capacity = 4096;
-  GraphStreamUpdate upds[buffer_capacity];
-  size_t buffer_size = 0;
-  output_stream.write_header(num_vertices, true_edges.size());
+  // the final graph is the first num_true edge ranks
+  GraphStreamUpdate upds[permute_batch_size];
+  size_t pairs[permute_batch_size];
+  output_stream.write_header(num_vertices, num_true);
 
-  for (auto e : true_edges) {
-    upds[buffer_size++] = {INSERT, e};
-    if (buffer_size >= buffer_capacity) {
-      output_stream.write_updates(upds, buffer_size);
-      buffer_size = 0;
-    }
-  }
-  if (buffer_size > 0) {
-    output_stream.write_updates(upds, buffer_size);
+  for (size_t e = 0; e < num_true; e += permute_batch_size) {
+    size_t batch = std::min(size_t(permute_batch_size), num_true - e);
+    edge_permute.permute_range(e, batch, pairs);
+    for (size_t j = 0; j < batch; j++) upds[j] = {INSERT, vertex_pair(num_vertices, pairs[j])};
+    output_stream.write_updates(upds, batch);
   }
+  output_stream.close();
+}
+
+GraphStreamUpdate DynamicErdosGenerator::get_next_edge() {
+  GraphStreamUpdate upd = make_update(edge_idx, update_permute[edge_idx]);
+  ++edge_idx;
+  return upd;
 }
 
-GraphStreamUpdate DynamicErdosGenerator::get_next_edge() { return updates[edge_idx++]; }
+void DynamicErdosGenerator::get_updates(edge_id_t begin, edge_id_t end,
+                                        GraphStreamUpdate *upds) const {
+  size_t canonical[permute_batch_size];
+  for (edge_id_t idx = begin; idx < end; idx += permute_batch_size) {
+    size_t batch = std::min(size_t(permute_batch_size), size_t(end - idx));
+    update_permute.permute_range(idx, batch, canonical);
+    for (size_t j = 0; j < batch; j++) upds[idx - begin + j] = make_update(idx + j, canonical[j]);
+  }
+}
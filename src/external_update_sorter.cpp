@@ -0,0 +1,287 @@
+#include "external_update_sorter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "run_threads.h"
+
+namespace {
+inline bool update_less(const IndexedUpdate &a, const IndexedUpdate &b) {
+  if (a.src != b.src) return a.src < b.src;
+  if (a.dst != b.dst) return a.dst < b.dst;
+  return a.idx < b.idx;
+}
+
+// orders a heap of runs so that the run with the smallest current update is at the front
+struct RunGreater {
+  template <typename RunT>
+  bool operator()(const RunT *a, const RunT *b) const {
+    return update_less(*b->cur, *a->cur);
+  }
+};
+
+// split buf into up to num_threads parts and call f(part, begin, end) for each part on its own
+// thread. Returns the number of parts.
+template <typename Func>
+size_t for_each_part(std::vector<IndexedUpdate> &buf, size_t num_threads, Func f) {
+  if (buf.size() == 0) return 0;
+  size_t parts = std::min(num_threads, buf.size());
+  size_t part_size = (buf.size() + parts - 1) / parts;
+  parts = (buf.size() + part_size - 1) / part_size;
+
+  run_threads(parts, [&](size_t p) {
+    IndexedUpdate *begin = buf.data() + p * part_size;
+    IndexedUpdate *end = buf.data() + std::min(buf.size(), (p + 1) * part_size);
+    f(p, begin, end);
+  });
+  return parts;
+}
+
+// Merge the runs of a heap ordered by RunGreater into upds, up to max_upds of them. refill(run)
+// is called on runs that are used up and returns false if the run has no more updates, in which
+// case it leaves the heap. Returns the number of updates merged.
+template <typename RunT, typename Refill>
+size_t merge(std::vector<RunT *> &heap, IndexedUpdate *upds, size_t max_upds, Refill refill) {
+  size_t num = 0;
+  while (num < max_upds && heap.size() > 0) {
+    if (heap.size() == 1) {
+      // only one run remains, copy it directly
+      RunT &run = *heap[0];
+      size_t copy = std::min(size_t(run.end - run.cur), max_upds - num);
+      std::copy(run.cur, run.cur + copy, upds + num);
+      run.cur += copy;
+      num += copy;
+      if (run.cur == run.end && !refill(run)) heap.pop_back();
+      continue;
+    }
+
+    std::pop_heap(heap.begin(), heap.end(), RunGreater());
+    RunT &run = *heap.back();
+    upds[num++] = *run.cur++;
+    if (run.cur == run.end && !refill(run))
+      heap.pop_back();
+    else
+      std::push_heap(heap.begin(), heap.end(), RunGreater());
+  }
+  return num;
+}
+
+void write_all(int fd, const IndexedUpdate *upds, size_t num, size_t upd_off) {
+  const char *data = (const char *) upds;
+  size_t bytes = num * sizeof(IndexedUpdate);
+  size_t offset = upd_off * sizeof(IndexedUpdate);
+  for (size_t written = 0; written < bytes;) {
+    ssize_t ret = pwrite(fd, data + written, bytes - written, offset + written);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret <= 0)
+      throw StreamException("ExternalUpdateSorter: Could not write run: " +
+                            std::string(strerror(errno)));
+    written += ret;
+  }
+}
+}  // namespace
+
+ExternalUpdateSorter::ExternalUpdateSorter(std::string temp_dir, size_t mem_bytes,
+                                           size_t num_threads)
+    : temp_dir(temp_dir), num_threads(std::max(num_threads, size_t(1))) {
+  // the threads merging a spill write through buffers taken from the budget
+  size_t mem_updates = mem_bytes / sizeof(IndexedUpdate);
+  size_t threads = this->num_threads;
+  spill_buffer = std::max(size_t(1), std::min(size_t(1) << 14, mem_updates / 8 / threads));
+  buffer_capacity = std::max(mem_updates - threads * spill_buffer, size_t(min_read_buffer));
+
+  // a merge needs a read buffer per run and a write buffer, and keeps a file per run open. Up to
+  // fan_in - 1 runs of each level are open at once.
+  size_t max_files = 1024;
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    max_files = limit.rlim_cur;
+  fan_in = std::min({size_t(max_fan_in), buffer_capacity / min_read_buffer - 1, max_files / 8});
+  fan_in = std::max(fan_in, size_t(2));
+  buffer.reserve(buffer_capacity);
+}
+
+ExternalUpdateSorter::~ExternalUpdateSorter() {
+  for (auto &run : runs)
+    if (run.fd != -1) close(run.fd);
+  if (!run_dir.empty()) rmdir(run_dir.c_str());
+}
+
+int ExternalUpdateSorter::create_run_file() {
+#ifdef O_TMPFILE
+  // an unnamed file needs no directory and disappears with the process
+  int tmp_fd = open(temp_dir.c_str(), O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+  if (tmp_fd != -1) return tmp_fd;
+#endif
+
+  // otherwise the files are created in a directory of their own and unlinked right away
+  if (run_dir.empty()) {
+    std::string path_template = temp_dir + "/update_sort_XXXXXX";
+    std::vector<char> path(path_template.begin(), path_template.end());
+    path.push_back('\0');
+    if (mkdtemp(path.data()) == nullptr)
+      throw StreamException("ExternalUpdateSorter: Could not create directory in " + temp_dir +
+                            ": " + strerror(errno));
+    run_dir = path.data();
+  }
+
+  std::string file_name = run_dir + "/run_" + std::to_string(num_run_files++);
+  int fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd == -1)
+    throw StreamException("ExternalUpdateSorter: Could not open run file " + file_name + ": " +
+                          strerror(errno));
+  unlink(file_name.c_str());
+  return fd;
+}
+
+void ExternalUpdateSorter::write_runs() {
+  std::vector<std::pair<IndexedUpdate *, IndexedUpdate *>> parts(num_threads);
+  parts.resize(for_each_part(buffer, num_threads,
+                             [&](size_t p, IndexedUpdate *begin, IndexedUpdate *end) {
+    std::sort(begin, end, update_less);
+    parts[p] = {begin, end};
+  }));
+
+  // split the keys at evenly spaced updates of the first part, so that every thread merges about
+  // as many updates of all parts and writes them to its own range of the run
+  size_t merges = parts.size();
+  std::vector<std::vector<IndexedUpdate *>> bounds(merges + 1);
+  for (size_t t = 0; t <= merges; t++) {
+    for (auto &part : parts) {
+      if (t == 0 || t == merges) {
+        bounds[t].push_back(t == 0 ? part.first : part.second);
+      } else {
+        IndexedUpdate split = parts[0].first[(parts[0].second - parts[0].first) * t / merges];
+        bounds[t].push_back(std::lower_bound(part.first, part.second, split, update_less));
+      }
+    }
+  }
+
+  Run run;
+  run.fd = create_run_file();
+  run.file_size = buffer.size();
+  runs.push_back(run);
+  int fd = run.fd;
+  run_threads(merges, [&](size_t t) {
+    size_t out_off = 0;
+    std::vector<Run> ranges(parts.size());
+    std::vector<Run *> merge_heap;
+    for (size_t p = 0; p < parts.size(); p++) {
+      out_off += bounds[t][p] - parts[p].first;
+      ranges[p].cur = bounds[t][p];
+      ranges[p].end = bounds[t + 1][p];
+      if (ranges[p].cur != ranges[p].end) merge_heap.push_back(&ranges[p]);
+    }
+    std::make_heap(merge_heap.begin(), merge_heap.end(), RunGreater());
+
+    std::vector<IndexedUpdate> out(spill_buffer);
+    auto in_memory = [](Run &) { return false; };
+    while (size_t num = merge(merge_heap, out.data(), out.size(), in_memory)) {
+      write_all(fd, out.data(), num, out_off);
+      out_off += num;
+    }
+  });
+  ++num_disk_runs;
+  buffer.clear();
+
+  // merge runs of equal level once fan_in of them accumulate
+  while (runs.size() >= fan_in && runs[runs.size() - fan_in].level == runs.back().level)
+    merge_runs(fan_in);
+}
+
+void ExternalUpdateSorter::sort_in_memory() {
+  runs.resize(std::min(num_threads, buffer.size()));
+  size_t parts = for_each_part(buffer, num_threads,
+                               [&](size_t p, IndexedUpdate *begin, IndexedUpdate *end) {
+    std::sort(begin, end, update_less);
+    runs[p].cur = begin;
+    runs[p].end = end;
+  });
+  runs.resize(parts);
+}
+
+void ExternalUpdateSorter::merge_runs(size_t num) {
+  // the buffer is empty and split into a read buffer per run and a write buffer
+  size_t first = runs.size() - num;
+  size_t buf_size = buffer_capacity / (num + 1);
+  buffer.resize(buffer_capacity);
+  std::vector<Run *> merge_heap;
+  for (size_t r = first; r < runs.size(); r++) {
+    runs[r].read_buf = buffer.data() + (r - first) * buf_size;
+    runs[r].read_buf_size = buf_size;
+    if (refill(runs[r])) merge_heap.push_back(&runs[r]);
+  }
+  std::make_heap(merge_heap.begin(), merge_heap.end(), RunGreater());
+
+  Run merged;
+  merged.fd = create_run_file();
+  merged.level = runs.back().level + 1;
+  IndexedUpdate *out = buffer.data() + num * buf_size;
+  auto refill_run = [this](Run &run) { return refill(run); };
+  while (size_t upds = merge(merge_heap, out, buf_size, refill_run)) {
+    write_all(merged.fd, out, upds, merged.file_size);
+    merged.file_size += upds;
+  }
+
+  for (size_t r = first; r < runs.size(); r++) close(runs[r].fd);
+  runs.resize(first);
+  runs.push_back(merged);
+  buffer.clear();
+}
+
+bool ExternalUpdateSorter::refill(Run &run) {
+  if (run.fd == -1 || run.file_off == run.file_size) return false;
+
+  size_t num = std::min(run.read_buf_size, run.file_size - run.file_off);
+  char *data = (char *) run.read_buf;
+  size_t bytes = num * sizeof(IndexedUpdate);
+  size_t offset = run.file_off * sizeof(IndexedUpdate);
+  for (size_t done = 0; done < bytes;) {
+    ssize_t ret = pread(run.fd, data + done, bytes - done, offset + done);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret <= 0)
+      throw StreamException("ExternalUpdateSorter: Could not read run: " +
+                            std::string(ret == 0 ? "unexpected end of file" : strerror(errno)));
+    done += ret;
+  }
+  run.cur = run.read_buf;
+  run.end = run.read_buf + num;
+  run.file_off += num;
+  return true;
+}
+
+void ExternalUpdateSorter::finish() {
+  if (finished) return;
+  finished = true;
+
+  if (num_disk_runs > 0) {
+    if (buffer.size() > 0) write_runs();
+
+    // merge the smallest runs until the rest can be merged at once
+    while (runs.size() > fan_in) merge_runs(std::min(fan_in, runs.size() - fan_in + 1));
+
+    // the budget is now spent on read buffers for the runs
+    size_t per_run = buffer_capacity / runs.size();
+    buffer.resize(buffer_capacity);
+    for (size_t r = 0; r < runs.size(); r++) {
+      runs[r].read_buf = buffer.data() + r * per_run;
+      runs[r].read_buf_size = per_run;
+      refill(runs[r]);
+    }
+  } else {
+    sort_in_memory();
+  }
+
+  for (auto &run : runs)
+    if (run.cur != run.end) heap.push_back(&run);
+  std::make_heap(heap.begin(), heap.end(), RunGreater());
+}
+
+size_t ExternalUpdateSorter::read(IndexedUpdate *upds, size_t max_upds) {
+  if (!finished) throw StreamException("ExternalUpdateSorter: read before finish");
+  return merge(heap, upds, max_upds, [this](Run &run) { return refill(run); });
+}
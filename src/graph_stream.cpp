@@ -0,0 +1,31 @@
+#include "graph_stream.h"
+
+#include <istream>
+
+#include "ascii_file_stream.h"
+#include "binary_file_stream.h"
+#include "compressed_binary_stream.h"
+#include "mapped_ascii_file_stream.h"
+#include "mapped_binary_file_stream.h"
+#include "segmented_file_stream.h"
+
+std::unordered_map<size_t, GraphStream* (*)(std::istream&)> GraphStream::constructor_map = {
+  {BinaryFile, BinaryFileStream::construct_from_metadata},
+  {AsciiFile, AsciiFileStream::construct_from_metadata},
+  {MappedBinaryFile, MappedBinaryFileStream::construct_from_metadata},
+  {CompressedBinaryFile, CompressedBinaryStream::construct_from_metadata},
+  {MappedAsciiFile, MappedAsciiFileStream::construct_from_metadata},
+  {CompactBinaryFile, CompactBinaryFileStream::construct_from_metadata},
+  {MappedCompactBinaryFile, MappedCompactBinaryFileStream::construct_from_metadata},
+  {SegmentedFile, SegmentedFileStream::construct_from_metadata},
+};
+
+GraphStream* GraphStream::construct_stream_from_metadata(std::istream& in) {
+  size_t stream_type;
+  if (!(in >> stream_type))
+    throw StreamException("GraphStream: Could not read stream type from metadata");
+  auto it = constructor_map.find(stream_type);
+  if (it == constructor_map.end())
+    throw StreamException("GraphStream: Unknown stream type " + std::to_string(stream_type));
+  return it->second(in);
+}
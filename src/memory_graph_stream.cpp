@@ -0,0 +1,147 @@
+#include "memory_graph_stream.h"
+
+#include <sys/mman.h>
+
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "binary_file_stream.h"
+#include "mapped_ascii_file_stream.h"
+#include "segmented_file_stream.h"
+
+MemoryGraphStream::MemoryGraphStream(edge_id_t capacity, bool huge_pages)
+    : huge_pages(huge_pages) {
+  grow(std::max(capacity, edge_id_t(1)));
+}
+
+MemoryGraphStream::~MemoryGraphStream() { munmap(arena, arena_bytes); }
+
+void MemoryGraphStream::grow(edge_id_t capacity) {
+  size_t bytes = capacity * sizeof(GraphStreamUpdate);
+  void* addr = MAP_FAILED;
+  bool tlb = false;
+  if (huge_pages) {
+    bytes = (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+#ifdef MAP_HUGETLB
+    // fails unless enough huge pages are reserved, then transparent huge pages are tried
+    addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                -1, 0);
+    tlb = addr != MAP_FAILED;
+#endif
+  }
+  if (addr == MAP_FAILED)
+    addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED)
+    throw StreamException("MemoryGraphStream: Could not allocate arena of " +
+                          std::to_string(bytes) + " bytes");
+#ifdef MADV_HUGEPAGE
+  if (huge_pages && !tlb) madvise(addr, bytes, MADV_HUGEPAGE);
+#endif
+
+  if (arena != nullptr) {
+    memcpy(addr, arena, arena_capacity * sizeof(GraphStreamUpdate));
+    munmap(arena, arena_bytes);
+  }
+  arena = static_cast<GraphStreamUpdate*>(addr);
+  arena_bytes = bytes;
+  arena_capacity = bytes / sizeof(GraphStreamUpdate);
+  huge_tlb = tlb;
+}
+
+void MemoryGraphStream::write_header(node_id_t num_verts, edge_id_t num_edg) {
+  if (num_edg > arena_capacity) grow(num_edg);
+  num_vertices = num_verts;
+  num_edges = num_edg;
+  stream_off = 0;
+  write_idx = 0;
+}
+
+void MemoryGraphStream::load(GraphStream* src, size_t num_threads) {
+  if (src == this) return;
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+  write_header(src->vertices(), src->edges());
+  src->seek(0);
+  src->set_break_point(END_OF_STREAM);
+
+  // readers of streams that read at an update index
+  std::function<size_t(GraphStreamUpdate*, edge_id_t, edge_id_t)> read_at;
+  if (auto s = dynamic_cast<BinaryFileStream*>(src))
+    read_at = [s](GraphStreamUpdate* b, edge_id_t n, edge_id_t i) {
+      return s->read_updates_at(b, n, i);
+    };
+  else if (auto s = dynamic_cast<CompactBinaryFileStream*>(src))
+    read_at = [s](GraphStreamUpdate* b, edge_id_t n, edge_id_t i) {
+      return s->read_updates_at(b, n, i);
+    };
+  else if (auto s = dynamic_cast<SegmentedFileStream*>(src))
+    read_at = [s](GraphStreamUpdate* b, edge_id_t n, edge_id_t i) {
+      return s->read_updates_at(b, n, i);
+    };
+  else if (auto s = dynamic_cast<MemoryGraphStream*>(src))
+    read_at = [s](GraphStreamUpdate* b, edge_id_t n, edge_id_t i) {
+      return s->read_updates_at(b, n, i);
+    };
+  MappedAsciiFileStream* ascii = dynamic_cast<MappedAsciiFileStream*>(src);
+
+  if (!read_at && !ascii) {
+    // read front to back, the source may hold fewer updates than its header claims
+    std::vector<GraphStreamUpdate> buf(load_chunk + 1);
+    edge_id_t total = 0;
+    while (true) {
+      size_t num = std::min(edge_id_t(load_chunk), arena_capacity - total);
+      size_t upds_read = src->get_update_buffer(buf.data(), num);
+      bool at_end = upds_read > 0 && buf[upds_read - 1].type == BREAKPOINT;
+      if (at_end) --upds_read;
+      memcpy(arena + total, buf.data(), upds_read * sizeof(GraphStreamUpdate));
+      total += upds_read;
+      if (at_end || total == arena_capacity) break;
+    }
+    num_edges = total;
+    return;
+  }
+
+  // threads load chunks of the stream directly into the arena
+  std::atomic<edge_id_t> next_chunk{0};
+  std::atomic<edge_id_t> ascii_end{0};  // one past the last update parsed from an ascii file
+  std::vector<std::exception_ptr> exceptions(num_threads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      try {
+        if (read_at) {
+          while (true) {
+            edge_id_t begin = next_chunk.fetch_add(load_chunk);
+            if (begin >= num_edges) return;
+            edge_id_t num = std::min(edge_id_t(load_chunk), num_edges - begin);
+            if (read_at(arena + begin, num, begin) != num)
+              throw StreamException("MemoryGraphStream: source stream ended early");
+          }
+        }
+
+        // the ascii reader parses claimed lines in parallel and reports where they belong
+        std::vector<GraphStreamUpdate> buf(load_chunk + 1);
+        while (true) {
+          edge_id_t first;
+          size_t upds_read = ascii->get_update_buffer(buf.data(), load_chunk, first);
+          bool at_end = upds_read > 0 && buf[upds_read - 1].type == BREAKPOINT;
+          if (at_end) --upds_read;
+          memcpy(arena + first, buf.data(), upds_read * sizeof(GraphStreamUpdate));
+          // claims past the end of a short file hold no updates
+          edge_id_t end = ascii_end.load(), filled = upds_read > 0 ? first + upds_read : 0;
+          while (end < filled && !ascii_end.compare_exchange_weak(end, filled)) continue;
+          if (at_end) return;
+        }
+      } catch (...) {
+        exceptions[t] = std::current_exception();
+      }
+    });
+  }
+  for (auto& thr : threads) thr.join();
+  for (auto& e : exceptions)
+    if (e) std::rethrow_exception(e);
+
+  // the ascii file may hold fewer updates than its header claims
+  if (ascii) num_edges = ascii_end;
+}
@@ -0,0 +1,225 @@
+#include "permuted_set.h"
+
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define PERMUTED_SET_X86_KERNELS
+#endif
+
+/*
+ * Batched evaluation of PermutedSet
+ *
+ * Both Feistel rounds hash a single 8 byte value with XXH3_64bits_withSeed. For an 8 byte input
+ * XXH3 reduces to a few 64 bit operations (XXH3_len_4to8_64b followed by XXH3_rrmxmx):
+ *   keyed = rotl(x, 32) ^ bitflip  where bitflip only depends upon the seed and XXH3's secret
+ *   h = rrmxmx(keyed, 8)
+ * These are evaluated here directly, which allows evaluating 4 (AVX2) or 8 (AVX-512) indices at
+ * once. Before a kernel is used it is checked against XXH3 itself, so a different xxHash version
+ * falls back to the scalar operator[] instead of producing a different permutation.
+ *
+ * Outputs outside of [0, n) are cycle-walked in batches as well.
+ */
+
+namespace {
+constexpr uint64_t prime_mx2 = 0x9FB21C651E98DF25ULL;  // constant of XXH3_rrmxmx
+constexpr uint64_t input_len = sizeof(size_t);
+
+// One round of the permutation. Both rounds can be written as
+//   L = i >> L_shift, R = (i & R_mask) >> R_shift, b = i & b_mask
+//   i' = (R << L_shift) | ((hash(R) & hash_mask) ^ L) << R_shift | b
+// G splits i = L | b | R and H splits i = L | R | b.
+struct Round {
+  uint64_t bitflip;
+  uint64_t L_shift;
+  uint64_t R_mask;
+  uint64_t R_shift;
+  uint64_t b_mask;
+  uint64_t hash_mask;
+};
+
+typedef void (*batch_kernel_t)(const Round rounds[2], const size_t *in, size_t *out, size_t n);
+
+inline uint64_t seed_bitflip(uint64_t seed) {
+  seed ^= uint64_t(XXH_swap32(uint32_t(seed))) << 32;
+  return (XXH_readLE64(XXH3_kSecret + 8) ^ XXH_readLE64(XXH3_kSecret + 16)) - seed;
+}
+
+inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t hash8(uint64_t x, uint64_t bitflip) {
+  uint64_t h = rotl64(x, 32) ^ bitflip;
+  h ^= rotl64(h, 49) ^ rotl64(h, 24);
+  h *= prime_mx2;
+  h ^= (h >> 35) + input_len;
+  h *= prime_mx2;
+  return h ^ (h >> 28);
+}
+
+inline uint64_t apply_round(const Round &r, uint64_t i) {
+  uint64_t L = i >> r.L_shift;
+  uint64_t R = (i & r.R_mask) >> r.R_shift;
+  uint64_t b = i & r.b_mask;
+  uint64_t hash_value = hash8(R, r.bitflip) & r.hash_mask;
+  return (R << r.L_shift) | ((hash_value ^ L) << r.R_shift) | b;
+}
+
+void scalar_kernel(const Round rounds[2], const size_t *in, size_t *out, size_t n) {
+  for (size_t j = 0; j < n; j++) out[j] = apply_round(rounds[1], apply_round(rounds[0], in[j]));
+}
+
+#ifdef PERMUTED_SET_X86_KERNELS
+__attribute__((target("avx2"))) inline __m256i mul64_avx2(__m256i a, __m256i b) {
+  // AVX2 has no 64 bit multiply, compose it from 32 bit multiplies
+  __m256i lo = _mm256_mul_epu32(a, b);
+  __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                   _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2"))) inline __m256i round_avx2(const Round &r, __m256i i) {
+  __m128i L_shift = _mm_cvtsi64_si128(r.L_shift);
+  __m128i R_shift = _mm_cvtsi64_si128(r.R_shift);
+  __m256i L = _mm256_srl_epi64(i, L_shift);
+  __m256i R = _mm256_srl_epi64(_mm256_and_si256(i, _mm256_set1_epi64x(r.R_mask)), R_shift);
+  __m256i b = _mm256_and_si256(i, _mm256_set1_epi64x(r.b_mask));
+
+  __m256i prime = _mm256_set1_epi64x(prime_mx2);
+  __m256i h = _mm256_xor_si256(_mm256_shuffle_epi32(R, 0xB1), _mm256_set1_epi64x(r.bitflip));
+  __m256i rot49 = _mm256_or_si256(_mm256_slli_epi64(h, 49), _mm256_srli_epi64(h, 15));
+  __m256i rot24 = _mm256_or_si256(_mm256_slli_epi64(h, 24), _mm256_srli_epi64(h, 40));
+  h = _mm256_xor_si256(h, _mm256_xor_si256(rot49, rot24));
+  h = mul64_avx2(h, prime);
+  h = _mm256_xor_si256(h, _mm256_add_epi64(_mm256_srli_epi64(h, 35),
+                                           _mm256_set1_epi64x(input_len)));
+  h = mul64_avx2(h, prime);
+  h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 28));
+  h = _mm256_and_si256(h, _mm256_set1_epi64x(r.hash_mask));
+
+  __m256i new_L = _mm256_sll_epi64(R, L_shift);
+  __m256i new_R = _mm256_sll_epi64(_mm256_xor_si256(h, L), R_shift);
+  return _mm256_or_si256(_mm256_or_si256(new_L, new_R), b);
+}
+
+__attribute__((target("avx2")))
+void avx2_kernel(const Round rounds[2], const size_t *in, size_t *out, size_t n) {
+  size_t j = 0;
+  for (; j + 4 <= n; j += 4) {
+    __m256i i = _mm256_loadu_si256((const __m256i *)(in + j));
+    i = round_avx2(rounds[1], round_avx2(rounds[0], i));
+    _mm256_storeu_si256((__m256i *)(out + j), i);
+  }
+  scalar_kernel(rounds, in + j, out + j, n - j);
+}
+
+// some gcc versions warn about the deliberately undefined registers in their avx512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f,avx512dq"))) inline __m512i round_avx512(const Round &r,
+                                                                         __m512i i) {
+  __m128i L_shift = _mm_cvtsi64_si128(r.L_shift);
+  __m128i R_shift = _mm_cvtsi64_si128(r.R_shift);
+  __m512i L = _mm512_srl_epi64(i, L_shift);
+  __m512i R = _mm512_srl_epi64(_mm512_and_si512(i, _mm512_set1_epi64(r.R_mask)), R_shift);
+  __m512i b = _mm512_and_si512(i, _mm512_set1_epi64(r.b_mask));
+
+  __m512i prime = _mm512_set1_epi64(prime_mx2);
+  __m512i h = _mm512_xor_si512(_mm512_rol_epi64(R, 32), _mm512_set1_epi64(r.bitflip));
+  h = _mm512_xor_si512(h, _mm512_xor_si512(_mm512_rol_epi64(h, 49), _mm512_rol_epi64(h, 24)));
+  h = _mm512_mullo_epi64(h, prime);
+  h = _mm512_xor_si512(h, _mm512_add_epi64(_mm512_srli_epi64(h, 35),
+                                           _mm512_set1_epi64(input_len)));
+  h = _mm512_mullo_epi64(h, prime);
+  h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 28));
+  h = _mm512_and_si512(h, _mm512_set1_epi64(r.hash_mask));
+
+  __m512i new_L = _mm512_sll_epi64(R, L_shift);
+  __m512i new_R = _mm512_sll_epi64(_mm512_xor_si512(h, L), R_shift);
+  return _mm512_or_si512(_mm512_or_si512(new_L, new_R), b);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+void avx512_kernel(const Round rounds[2], const size_t *in, size_t *out, size_t n) {
+  size_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m512i i = _mm512_loadu_si512((const void *)(in + j));
+    i = round_avx512(rounds[1], round_avx512(rounds[0], i));
+    _mm512_storeu_si512((void *)(out + j), i);
+  }
+  scalar_kernel(rounds, in + j, out + j, n - j);
+}
+#pragma GCC diagnostic pop
+#endif  // PERMUTED_SET_X86_KERNELS
+
+// check that the closed form of the 8 byte XXH3 path matches the xxHash we are built against
+bool closed_form_matches_xxh3() {
+  const size_t seeds[] = {0, 1, 0xdeadbeef, size_t(-1), 0x123456789abcdef};
+  const size_t inputs[] = {0, 1, 0xffffffff, 0x100000000, size_t(-1), 0x0123456789abcdef};
+  for (size_t seed : seeds) {
+    for (size_t x : inputs) {
+      if (hash8(x, seed_bitflip(seed)) != hash(&x, sizeof(x), seed)) return false;
+    }
+  }
+  return true;
+}
+
+// returns the fastest kernel supported by this cpu or nullptr if operator[] must be used
+batch_kernel_t select_kernel() {
+  if (!closed_form_matches_xxh3()) return nullptr;
+#ifdef PERMUTED_SET_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+    return avx512_kernel;
+  if (__builtin_cpu_supports("avx2")) return avx2_kernel;
+#endif
+  return scalar_kernel;
+}
+
+const batch_kernel_t batch_kernel = select_kernel();
+}  // namespace
+
+void PermutedSet::permute_batch(const size_t *in, size_t *out, size_t num) const {
+  if (batch_kernel == nullptr) {
+    for (size_t j = 0; j < num; j++) out[j] = (*this)[in[j]];
+    return;
+  }
+
+  // round 0 is G(i, 0) and round 1 is H(i, 1)
+  Round rounds[2];
+  rounds[0] = {seed_bitflip(hash_seeds[0]), L_shift, GR_mask, 0, Gb_mask, GR_mask};
+  rounds[1] = {seed_bitflip(hash_seeds[1]), L_shift, HR_mask, is_odd, is_odd, GR_mask};
+  batch_kernel(rounds, in, out, num);
+
+  // cycle-walk the outputs that are not within [0, n). These are gathered into a small batch and
+  // permuted again until all of them have left the walk.
+  constexpr size_t walk_capacity = 256;
+  size_t walk_pos[walk_capacity];
+  size_t walk_val[walk_capacity];
+  size_t walking = 0;
+  for (size_t j = 0; j <= num; j++) {
+    if (j < num && out[j] >= n) {
+      walk_pos[walking] = j;
+      walk_val[walking++] = out[j];
+    }
+    if (walking == walk_capacity || (j == num && walking > 0)) {
+      while (walking > 0) {
+        batch_kernel(rounds, walk_val, walk_val, walking);
+        size_t still_walking = 0;
+        for (size_t w = 0; w < walking; w++) {
+          if (walk_val[w] < n) {
+            out[walk_pos[w]] = walk_val[w];
+          } else {
+            walk_pos[still_walking] = walk_pos[w];
+            walk_val[still_walking++] = walk_val[w];
+          }
+        }
+        walking = still_walking;
+      }
+    }
+  }
+}
+
+void PermutedSet::permute_range(size_t begin, size_t num, size_t *out) const {
+  for (size_t j = 0; j < num; j++) out[j] = begin + j;
+  permute_batch(out, out, num);
+}
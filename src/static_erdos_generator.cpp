@@ -1,66 +1,103 @@
 #include "static_erdos_generator.h"
 #include "ascii_file_stream.h"
 #include "binary_file_stream.h"
+#include "buffered_output_stream.h"
+#include "run_threads.h"
+#include "vertex_pairs.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 StaticErdosGenerator::StaticErdosGenerator(size_t seed, node_id_t num_vertices, double density)
     : num_vertices(num_vertices),
       density(density),
       seed(seed),
-      total_edges(size_t(num_vertices) * (size_t(num_vertices) - 1) / 2 * density),
-      permute(num_vertices * num_vertices / 2, seed) {
-
-  if (log2(num_vertices) - size_t(log2(num_vertices)) != 0) {
-    throw StreamException("StaticErdosGenerator: Number of vertices must be a power of 2!");
-  }
-  v_bits = log2(num_vertices);
+      num_pairs(num_vertex_pairs(num_vertices)),
+      total_edges(num_pairs * density),
+      permute(num_pairs, seed) {
+  if (density < 0 || density > 1)
+    throw StreamException("StaticErdosGenerator: Density must be within [0, 1]");
 }
 
 void write_to_file(GraphStream *stream, StaticErdosGenerator &gen) {
+  // the updates are written on a background thread while the next ones are generated
+  BufferedOutputStream output(stream);
   size_t buffer_capacity = 4096;
   GraphStreamUpdate upds[buffer_capacity];
   size_t buffer_size = 0;
-  stream->write_header(gen.get_num_vertices(), gen.get_num_edges());
-  
+  output.write_header(gen.get_num_vertices(), gen.get_num_edges());
+
   for (edge_id_t i = 0; i < gen.get_num_edges(); i++) {
     upds[buffer_size++] = gen.get_next_edge();
     if (buffer_size >= buffer_capacity) {
-      stream->write_updates(upds, buffer_size);
+      output.write_updates(upds, buffer_size);
       buffer_size = 0;
     }
   }
   if (buffer_size > 0) {
-    stream->write_updates(upds, buffer_size);
+    output.write_updates(upds, buffer_size);
   }
+  output.close();
 }
 
-void StaticErdosGenerator::to_binary_file(std::string file_name) {
-  edge_idx = 0;
+void StaticErdosGenerator::to_binary_file(std::string file_name, size_t num_threads) {
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
   BinaryFileStream output_stream(file_name, false);
+  output_stream.write_header(num_vertices, total_edges);
+
+  // Every edge index maps to exactly one edge, so each thread generates chunks of the stream
+  // independently and writes them at their position in the file.
+  size_t num_chunks = (total_edges + edge_chunk - 1) / edge_chunk;
+  run_threads(num_threads, [&](size_t t) {
+    std::vector<GraphStreamUpdate> upds(edge_chunk);
+    for (size_t c = t; c < num_chunks; c += num_threads) {
+      edge_id_t begin = c * edge_chunk;
+      edge_id_t end = std::min(total_edges, begin + edge_chunk);
+      get_edges(begin, end, upds.data());
+      output_stream.write_updates_at(upds.data(), end - begin, begin);
+    }
+  });
+}
+
+void StaticErdosGenerator::to_memory_stream(MemoryGraphStream &stream, size_t num_threads) {
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  stream.write_header(num_vertices, total_edges);
+  size_t num_chunks = (total_edges + edge_chunk - 1) / edge_chunk;
+  run_threads(num_threads, [&](size_t t) {
+    for (size_t c = t; c < num_chunks; c += num_threads) {
+      edge_id_t begin = c * edge_chunk;
+      edge_id_t end = std::min(total_edges, begin + edge_chunk);
+      get_edges(begin, end, stream.data() + begin);
+    }
+  });
+}
+
+void StaticErdosGenerator::to_compact_binary_file(std::string file_name) {
+  edge_idx = 0;
+  CompactBinaryFileStream output_stream(file_name, false);
   write_to_file(&output_stream, *this);
 }
 void StaticErdosGenerator::to_ascii_file(std::string file_name) {
   edge_idx = 0;
-  AsciiFileStream output_stream(file_name, true);
+  AsciiFileStream output_stream(file_name, true, std::thread::hardware_concurrency());
   write_to_file(&output_stream, *this);
+  output_stream.close();
 }
 
-static Edge extract_edge(size_t v_bits, size_t packed_edge) {
-  Edge e{node_id_t(packed_edge >> v_bits) << 1,
-          node_id_t(packed_edge & ((size_t(1) << v_bits) - 1))};
-  if (e.src > e.dst && e.dst % 2 == 0) {
-    ++e.src; ++ e.dst;
-  }
-  return e;
+GraphStreamUpdate StaticErdosGenerator::get_next_edge() {
+  return {INSERT, vertex_pair(num_vertices, permute[edge_idx++])};
 }
 
-GraphStreamUpdate StaticErdosGenerator::get_next_edge() {
-  Edge e = extract_edge(v_bits, permute[edge_idx + skip]);
-  
-  while (e.src == e.dst) {
-    ++skip;
-    e = extract_edge(v_bits, permute[edge_idx + skip]);
+void StaticErdosGenerator::get_edges(edge_id_t begin, edge_id_t end,
+                                     GraphStreamUpdate *upds) const {
+  size_t pairs[permute_batch_size];
+  for (edge_id_t idx = begin; idx < end; idx += permute_batch_size) {
+    size_t batch = std::min(size_t(permute_batch_size), size_t(end - idx));
+    permute.permute_range(idx, batch, pairs);
+    for (size_t j = 0; j < batch; j++)
+      upds[idx - begin + j] = {INSERT, vertex_pair(num_vertices, pairs[j])};
   }
-  ++edge_idx;
-
-  return {INSERT, e};
 }
@@ -24,6 +24,38 @@ bool verify(size_t bits, size_t seed) {
   return true;
 }
 
+// check that a domain that is not a power of two is permuted and inverted correctly
+bool verify_domain(size_t n, size_t seed) {
+  std::vector<bool> appeared(n, false);
+  PermutedSet p(n, seed);
+
+  for (size_t i = 0; i < n; i++) {
+    size_t permute = p[i];
+    if (permute >= n || appeared[permute] == true || p.inverse(permute) != i) {
+      return false;
+    }
+    appeared[permute] = true;
+  }
+  return true;
+}
+
+// check that permute_batch() agrees with operator[] on a set of unaligned batches
+bool verify_batch(size_t n, size_t seed) {
+  PermutedSet p(n, seed);
+  std::vector<size_t> in(n);
+  std::vector<size_t> out(in.size());
+  for (size_t i = 0; i < in.size(); i++) in[i] = in.size() - i - 1;
+
+  for (size_t i = 0, batch = 1; i < in.size(); i += batch, batch = batch * 2 + 1) {
+    batch = std::min(batch, in.size() - i);
+    p.permute_batch(in.data() + i, out.data() + i, batch);
+  }
+  for (size_t i = 0; i < in.size(); i++) {
+    if (out[i] != p[in[i]]) return false;
+  }
+  return true;
+}
+
 int main(int argc, char **argv) {
   if (argc != 2) {
     std::cerr << "Incorrect number of arguments!" << std::endl;
@@ -49,6 +81,26 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
 
+  // permute the same set in batches
+  size_t batch_size = 4096;
+  std::vector<size_t> batch(batch_size);
+  start = std::chrono::steady_clock::now();
+  size_t batch_sum = 0;
+  for (size_t i = 0; i < size_t(1) << bits; i += batch_size) {
+    size_t n = std::min(batch_size, (size_t(1) << bits) - i);
+    p.permute_range(i, n, batch.data());
+    for (size_t j = 0; j < n; j++) batch_sum += batch[j];
+  }
+  latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "Batched permuted set of size " << (1 << bits) << " in "
+            << latency
+            << " seconds, rate = " << (1 << bits) / latency << std::endl;
+
+  if (batch_sum != sum) {
+    std::cerr << "ERROR: Batch Mismatch!!!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
   std::cout << std::endl;
   std::cout << "Verifying correctness of partition (even bits)" << std::endl;
   size_t seed = get_seed();
@@ -67,4 +119,23 @@ int main(int argc, char **argv) {
     std::cout << "  ERROR: Incorrect partition!" << std::endl;
     std::cout << "  19 bit universe. Seed = " << seed << std::endl;
   }
+
+  std::cout << "Verifying correctness of partition (arbitrary size)" << std::endl;
+  seed = get_seed();
+  if (verify_domain(300007, seed) && verify_domain(393216, seed)) {
+    std::cout << "  Success!" << std::endl;
+  } else {
+    std::cout << "  ERROR: Incorrect partition!" << std::endl;
+    std::cout << "  Sizes 300007 and 393216. Seed = " << seed << std::endl;
+  }
+
+  std::cout << "Verifying batches match operator[]" << std::endl;
+  seed = get_seed();
+  if (verify_batch(size_t(1) << 18, seed) && verify_batch(size_t(1) << 19, seed) &&
+      verify_batch(300007, seed)) {
+    std::cout << "  Success!" << std::endl;
+  } else {
+    std::cout << "  ERROR: Batch differs from operator[]!" << std::endl;
+    std::cout << "  Seed = " << seed << std::endl;
+  }
 }
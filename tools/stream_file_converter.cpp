@@ -3,39 +3,86 @@
 #include <string.h>
 #include "ascii_file_stream.h"
 #include "binary_file_stream.h"
+#include "compressed_binary_stream.h"
+#include "edge_state_set.h"
+#include "external_update_sorter.h"
+#include "mapped_ascii_file_stream.h"
+#include "segmented_file_stream.h"
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 const std::string USAGE = "\n\
 This program converts between multiple graph stream formats.\n\
 USAGE:\n\
   Arguments: input_file input_type output_file output_type [--to_static] [--silent]\n\
+             [--mem megabytes]\n\
     input_file:  The location of the file stream to convert\n\
     input_type:  The type of the input file [see types below]\n\
     output_file: Where to place the converted output stream\n\
     output_type: The type of the output file [see types below]\n\
     to_static:   [OPTIONAL] Output only the edge list for the graph state at end of input stream\n\
     silent:      [OPTIONAL] Do not print warnings\n\
+    megabytes:   [OPTIONAL] With to_static, build the final graph out of core within this memory\n\
+                 budget rather than in memory that grows with the number of vertices. Sorted\n\
+                 runs are placed in the directory of output_file.\n\
 \n\
   Output and input types must be one of the following\n\
     ascii_stream:        An ascii file stream that states edge update type (insert vs delete).\n\
     notype_ascii_stream: An ascii file stream that contains only edge source and destination.\n\
     binary_stream:       A binary file stream.\n\
+    compact_binary_stream: A binary file stream of 8 byte updates (at most 2^31 vertices).\n\
+    compressed_stream:   A block compressed binary stream (see CompressedBinaryStream).\n\
+    segmented_stream:    A binary stream split into segment files of up to 2^27 updates. The\n\
+                         file is the manifest, see SegmentedFileStream.\n\
 \n\
   Additionally, optional arguments must come last.";
 
+// is this a stream type that we know how to create
+bool valid_stream_type(std::string file_type) {
+  return file_type == "notype_ascii_stream" || file_type == "ascii_stream" ||
+         file_type == "binary_stream" || file_type == "compact_binary_stream" ||
+         file_type == "compressed_stream" || file_type == "segmented_stream";
+}
+
 // create a stream based on parsed information
-GraphStream *create_stream(std::string file_name, bool ascii, bool type, bool read) {
+GraphStream *create_stream(std::string file_name, std::string file_type, bool read) {
   GraphStream *ret;
-  if (ascii) {
-    ret = (GraphStream *) new AsciiFileStream(file_name, type);
+  if (file_type == "ascii_stream" || file_type == "notype_ascii_stream") {
+    // ascii input is parsed from a mapping, much faster than through an fstream
+    if (read)
+      ret = (GraphStream *) new MappedAsciiFileStream(file_name, file_type == "ascii_stream");
+    else
+      ret = (GraphStream *) new AsciiFileStream(file_name, file_type == "ascii_stream",
+                                                std::thread::hardware_concurrency());
+  } else if (file_type == "compact_binary_stream") {
+    ret = (GraphStream *) new CompactBinaryFileStream(file_name, read);
+  } else if (file_type == "compressed_stream") {
+    ret = (GraphStream *) new CompressedBinaryStream(file_name, read);
+  } else if (file_type == "segmented_stream") {
+    if (read)
+      ret = (GraphStream *) new SegmentedFileStream(file_name);
+    else
+      ret = (GraphStream *) new SegmentedFileStream(file_name, edge_id_t(1) << 27);
   } else {
     ret = (GraphStream *) new BinaryFileStream(file_name, read);
   }
   return ret;
 }
 
+// delete an output stream, reporting errors writing an ascii stream that its destructor ignores
+void close_output(GraphStream *output) {
+  if (AsciiFileStream *ascii = dynamic_cast<AsciiFileStream *>(output)) ascii->close();
+  delete output;
+}
+
 std::string print_type(UpdateType type) {
   if (type == INSERT) return "INSERT";
   if (type == DELETE) return "DELETE";
@@ -43,9 +90,331 @@ std::string print_type(UpdateType type) {
   return "UNKNOWN";
 }
 
+// A batch of updates moving through a ConversionPipeline
+struct ConversionBatch {
+  std::vector<GraphStreamUpdate> upds;
+  edge_id_t first_idx = 0;    // stream index of upds[0]
+  size_t size = 0;            // number of updates before the end of stream, if any
+  size_t workers_left = 0;    // workers yet to process the batch
+  std::vector<std::vector<std::pair<edge_id_t, std::string>>> warnings;  // per worker
+};
+
+/*
+ * Converts a stream in three stages that run concurrently:
+ *   readers  Fill batches from the input. Readers may finish batches out of order, so batches are
+ *            put back in stream order by the index of their first update.
+ *   workers  Each owns a shard of the EdgeStateSet and corrects the types of the updates to its
+ *            edges in every batch, so the updates to an edge are handled by one worker in stream
+ *            order. Worker 0 marks self loops and out of range edges to be dropped.
+ *   writer   Waits until the workers are done with the oldest batch, removes the dropped updates,
+ *            prints the warnings of the batch in stream order and writes the batch.
+ * A fixed pool of batches bounds the memory in use. The output and warnings are identical to
+ * converting the stream on a single thread.
+ */
+class ConversionPipeline {
+ public:
+  // read(buffer, capacity, set to the stream index of buffer[0]), see GraphStream
+  typedef std::function<size_t(GraphStreamUpdate *, size_t, edge_id_t &)> ReadFunc;
+  typedef std::function<void(GraphStreamUpdate *, size_t)> WriteFunc;
+
+  /**
+   * @param graph        The shards of the graph, one per worker. Holds the final graph after run.
+   * @param num_nodes    Number of vertices in the graph.
+   * @param silent       Do not print warnings.
+   * @param num_readers  Number of reader threads. Greater than 1 only if read is thread safe.
+   * @param batch_size   Number of updates per batch.
+   */
+  ConversionPipeline(std::vector<EdgeStateSet> &graph, node_id_t num_nodes, bool silent,
+                     size_t num_readers, size_t batch_size = 1 << 16)
+      : graph(graph),
+        num_nodes(num_nodes),
+        num_workers(graph.size()),
+        silent(silent),
+        num_readers(num_readers),
+        pool(2 * num_readers + 4) {
+    for (auto &batch : pool) {
+      batch.upds.resize(batch_size);
+      batch.warnings.resize(num_workers);
+      free_batches.push_back(&batch);
+    }
+  }
+
+  // convert the stream on the calling thread and the stage threads. Write is called on the
+  // calling thread with the converted updates in stream order. Returns the number written.
+  size_t run(ReadFunc read, WriteFunc write) {
+    std::vector<std::thread> threads;
+    for (size_t r = 0; r < num_readers; r++)
+      threads.emplace_back([&]() { run_stage([&]() { read_stage(read); }); });
+    for (size_t w = 0; w < num_workers; w++)
+      threads.emplace_back([&, w]() { run_stage([&]() { work_stage(w); }); });
+
+    size_t written = 0;
+    run_stage([&]() { written = write_stage(write); });
+    for (auto &thr : threads) thr.join();
+    if (stage_exception) std::rethrow_exception(stage_exception);
+    return written;
+  }
+
+ private:
+  std::vector<EdgeStateSet> &graph;
+  node_id_t num_nodes;
+  size_t num_workers;
+  bool silent;
+  size_t num_readers;
+  std::vector<ConversionBatch> pool;
+
+  // a single lock guards the stage hand offs, which happen once per batch
+  std::mutex lock;
+  std::condition_variable changed;
+  std::vector<ConversionBatch *> free_batches;
+  std::map<edge_id_t, ConversionBatch *> out_of_order;  // read batches by first index
+  std::deque<ConversionBatch *> in_order;  // batches in stream order that are not yet written
+  size_t first_in_order = 0;               // sequence number of in_order.front()
+  edge_id_t next_idx = 0;                  // stream index of the next batch to put in order
+  edge_id_t end_idx = END_OF_STREAM;       // stream index of the end of the stream once read
+  bool stopped = false;
+  std::exception_ptr stage_exception;
+
+  // all batches have been put in order
+  bool input_done() const { return next_idx == end_idx; }
+
+  // run a stage, stopping the others if it throws
+  template <typename Func>
+  void run_stage(Func f) {
+    try {
+      f();
+    } catch (...) {
+      std::lock_guard<std::mutex> lk(lock);
+      if (!stage_exception) stage_exception = std::current_exception();
+      stopped = true;
+      changed.notify_all();
+    }
+  }
+
+  void read_stage(ReadFunc &read) {
+    while (true) {
+      ConversionBatch *batch;
+      {
+        std::unique_lock<std::mutex> lk(lock);
+        changed.wait(lk, [&]() { return free_batches.size() > 0 || stopped || input_done(); });
+        if (stopped || input_done()) return;
+        batch = free_batches.back();
+        free_batches.pop_back();
+      }
+
+      size_t num = read(batch->upds.data(), batch->upds.size(), batch->first_idx);
+      batch->size = 0;
+      while (batch->size < num && batch->upds[batch->size].type != BREAKPOINT) ++batch->size;
+      bool end = batch->size < num;
+
+      std::lock_guard<std::mutex> lk(lock);
+      if (end) end_idx = batch->first_idx + batch->size;
+      if (batch->size > 0)
+        out_of_order[batch->first_idx] = batch;
+      else
+        free_batches.push_back(batch);
+
+      while (out_of_order.size() > 0 && out_of_order.begin()->first == next_idx) {
+        ConversionBatch *next = out_of_order.begin()->second;
+        out_of_order.erase(out_of_order.begin());
+        next->workers_left = num_workers;
+        in_order.push_back(next);
+        next_idx += next->size;
+      }
+      changed.notify_all();
+      if (end) return;
+    }
+  }
+
+  void work_stage(size_t w) {
+    constexpr size_t toggle_batch = 1024;
+    Edge toggle_edges[toggle_batch];
+    size_t toggle_idx[toggle_batch];
+    bool was_present[toggle_batch];
+    EdgeStateSet &shard = graph[w];
+
+    for (size_t seq = 0;; seq++) {
+      ConversionBatch *batch;
+      {
+        std::unique_lock<std::mutex> lk(lock);
+        changed.wait(lk, [&]() {
+          return seq < first_in_order + in_order.size() || stopped || input_done();
+        });
+        if (stopped || seq >= first_in_order + in_order.size()) return;
+        batch = in_order[seq - first_in_order];
+      }
+
+      GraphStreamUpdate *upds = batch->upds.data();
+      auto &warnings = batch->warnings[w];
+      size_t num_toggles = 0;
+      auto apply_toggles = [&]() {
+        shard.toggle_and_get(toggle_edges, num_toggles, was_present);
+        for (size_t i = 0; i < num_toggles; i++) {
+          GraphStreamUpdate &upd = upds[toggle_idx[i]];
+          if (!silent && upd.type != was_present[i]) {
+            warnings.emplace_back(batch->first_idx + toggle_idx[i],
+                                  "WARNING: update " + print_type((UpdateType) upd.type) + " " +
+                                      std::to_string(upd.edge.src) + " " +
+                                      std::to_string(upd.edge.dst) +
+                                      " is double insert or delete before insert.");
+          }
+          upd.type = was_present[i];
+        }
+        num_toggles = 0;
+      };
+
+      for (size_t i = 0; i < batch->size; i++) {
+        // only the edge may be read here, other workers write the types of their updates
+        Edge e = upds[i].edge;
+        node_id_t src = std::min(e.src, e.dst);
+        node_id_t dst = std::max(e.src, e.dst);
+
+        if (src == dst || dst >= num_nodes) {
+          // invalid edges belong to no shard, worker 0 drops them
+          if (w != 0) continue;
+          if (!silent) {
+            warnings.emplace_back(batch->first_idx + i,
+                                  std::string("WARNING: Dropping ") +
+                                      (src == dst ? "self loop" : "out of range") + " edge " +
+                                      std::to_string(src) + ", " + std::to_string(dst));
+          }
+          upds[i].type = BREAKPOINT;
+          continue;
+        }
+
+        if (!shard.owns(e)) continue;
+        toggle_edges[num_toggles] = e;
+        toggle_idx[num_toggles++] = i;
+        if (num_toggles == toggle_batch) apply_toggles();
+      }
+      apply_toggles();
+
+      std::lock_guard<std::mutex> lk(lock);
+      if (--batch->workers_left == 0) changed.notify_all();
+    }
+  }
+
+  size_t write_stage(WriteFunc &write) {
+    size_t written = 0;
+    for (size_t batches = 1;; batches++) {
+      ConversionBatch *batch;
+      {
+        std::unique_lock<std::mutex> lk(lock);
+        changed.wait(lk, [&]() {
+          return (in_order.size() > 0 && in_order.front()->workers_left == 0) || stopped ||
+                 (in_order.size() == 0 && input_done());
+        });
+        if (stopped || in_order.size() == 0) return written;
+        batch = in_order.front();
+        in_order.pop_front();
+        ++first_in_order;
+      }
+
+      // print the warnings of all workers in stream order
+      std::vector<std::pair<edge_id_t, std::string>> warnings;
+      for (auto &worker_warnings : batch->warnings) {
+        warnings.insert(warnings.end(), worker_warnings.begin(), worker_warnings.end());
+        worker_warnings.clear();
+      }
+      std::sort(warnings.begin(), warnings.end());
+      for (auto &warning : warnings) std::cerr << warning.second << std::endl;
+
+      // remove the dropped updates
+      GraphStreamUpdate *upds = batch->upds.data();
+      size_t kept = 0;
+      for (size_t i = 0; i < batch->size; i++)
+        if (upds[i].type != BREAKPOINT) upds[kept++] = upds[i];
+      write(upds, kept);
+      written += kept;
+
+      if (batches % 256 == 0) {
+        std::cout << "Processed: " << written << " edges           \r"; fflush(stdout);
+      }
+
+      std::lock_guard<std::mutex> lk(lock);
+      free_batches.push_back(batch);
+      changed.notify_all();
+    }
+  }
+};
+
+/*
+ * Write the final graph of the input stream to the output stream within a memory budget. The
+ * updates are sorted by (src, dst, index) with an external merge sort, after which the updates to
+ * each edge are adjacent and in stream order. An edge is in the final graph if it has an odd
+ * number of updates. The final edges are gathered in a second sorter so that their number is
+ * known before the header is written. Returns the number of final edges.
+ */
+size_t to_static_out_of_core(GraphStream *input, GraphStream *output, size_t mem_bytes,
+                             std::string temp_dir, bool silent) {
+  node_id_t num_nodes = input->vertices();
+  constexpr size_t buf_capacity = 4096;
+  GraphStreamUpdate buf[buf_capacity];
+
+  ExternalUpdateSorter updates(temp_dir, mem_bytes / 2, std::thread::hardware_concurrency());
+  for (size_t idx = 0;;) {
+    size_t read = input->get_update_buffer(buf, buf_capacity);
+    if (read == 1 && buf[0].type == BREAKPOINT) break;
+    for (size_t i = 0; i < read; i++) {
+      Edge e = buf[i].edge;
+      if (buf[i].type == BREAKPOINT) continue;
+      if (e.src == e.dst) {
+        if (!silent)
+          std::cerr << "WARNING: Dropping self loop edge " << e.src << ", " << e.dst << std::endl;
+        continue;
+      }
+      if (std::max(e.src, e.dst) >= num_nodes) {
+        if (!silent)
+          std::cerr << "WARNING: Dropping out of range edge " << std::min(e.src, e.dst) << ", "
+                    << std::max(e.src, e.dst) << std::endl;
+        continue;
+      }
+      updates.add(e, (UpdateType) buf[i].type, idx++);
+    }
+    if (idx % (buf_capacity * 10000) < read) {
+      std::cout << "Processed: " << idx << " edges           \r"; fflush(stdout);
+    }
+  }
+  updates.finish();
+
+  ExternalUpdateSorter final_edges(temp_dir, mem_bytes / 2);
+  IndexedUpdate sorted[buf_capacity];
+  IndexedUpdate last = {};
+  bool present = false;
+  bool has_last = false;
+  for (size_t num; (num = updates.read(sorted, buf_capacity)) > 0;) {
+    for (size_t i = 0; i < num; i++) {
+      if (has_last && sorted[i].same_edge(last)) {
+        present = !present;
+      } else {
+        if (present) final_edges.add(last.edge(), INSERT, final_edges.size());
+        present = true;
+      }
+      last = sorted[i];
+      has_last = true;
+
+      UpdateType type = sorted[i].update_type();
+      if (!silent && type != (present ? INSERT : DELETE)) {
+        Edge e = sorted[i].stream_edge();
+        std::cerr << "WARNING: update " << print_type(type) << " " << e.src << " " << e.dst;
+        std::cerr << " is double insert or delete before insert." << std::endl;
+      }
+    }
+  }
+  if (present) final_edges.add(last.edge(), INSERT, final_edges.size());
+  final_edges.finish();
+
+  output->write_header(num_nodes, final_edges.size());
+  for (size_t num; (num = final_edges.read(sorted, buf_capacity)) > 0;) {
+    for (size_t i = 0; i < num; i++) buf[i] = {INSERT, sorted[i].edge()};
+    output->write_updates(buf, num);
+  }
+  return final_edges.size();
+}
+
 int main(int argc, char **argv) {
-  if (argc < 5 || argc > 7) {
-    std::cerr << "ERROR: Incorrect number of arguments. Expected [4-6] but got "
+  if (argc < 5 || argc > 9) {
+    std::cerr << "ERROR: Incorrect number of arguments. Expected [4-8] but got "
               << argc - 1 << std::endl;
     std::cerr << USAGE << std::endl;
     exit(EXIT_FAILURE);
@@ -54,40 +423,43 @@ int main(int argc, char **argv) {
   std::string in_file_name = argv[1];
   std::string in_file_type = argv[2];
 
-  if (in_file_type != "notype_ascii_stream" && in_file_type != "ascii_stream" &&
-      in_file_type != "binary_stream") {
+  if (!valid_stream_type(in_file_type)) {
     std::cerr << "ERROR: Did not recognize input_file_type: " << in_file_type << std::endl;
     std::cerr << USAGE << std::endl;
     exit(EXIT_FAILURE);
   }
-  GraphStream *input = create_stream(in_file_name, in_file_type != "binary_stream",
-                                     in_file_type != "notype_ascii_stream", true);
+  GraphStream *input = create_stream(in_file_name, in_file_type, true);
 
   std::string out_file_name = argv[3];
   std::string out_file_type = argv[4];
 
-  if (out_file_type != "notype_ascii_stream" && out_file_type != "ascii_stream" &&
-      out_file_type != "binary_stream") {
+  if (!valid_stream_type(out_file_type)) {
     std::cerr << "ERROR: Did not recognize output_file_type: " << out_file_type << std::endl;
     std::cerr << USAGE << std::endl;
     exit(EXIT_FAILURE);
   }
-  GraphStream *output = create_stream(out_file_name, out_file_type != "binary_stream",
-                                      out_file_type != "notype_ascii_stream", false);
+  GraphStream *output = create_stream(out_file_name, out_file_type, false);
 
   bool to_static = false;
   bool silent = false;
+  size_t mem_bytes = 0;
   for (int i = 5; i < argc; i++) {
     if (std::string(argv[i]) == "--to_static")
       to_static = true;
     else if (std::string(argv[i]) == "--silent") {
       silent = true;
+    } else if (std::string(argv[i]) == "--mem" && i + 1 < argc) {
+      mem_bytes = std::max(1l, std::stol(argv[++i])) << 20;
     } else {
       std::cerr << "Did not recognize argument: " << argv[i]
-                << " Expected '--to_static' or '--silent'" << std::endl;
+                << " Expected '--to_static', '--silent', or '--mem megabytes'" << std::endl;
       exit(EXIT_FAILURE);
     }
   }
+  if (mem_bytes > 0 && !to_static) {
+    std::cerr << "ERROR: --mem requires --to_static" << std::endl;
+    exit(EXIT_FAILURE);
+  }
 
   node_id_t num_nodes = input->vertices();
   edge_id_t num_edges = input->edges();
@@ -97,85 +469,64 @@ int main(int argc, char **argv) {
   std::cout << "  Number of updates:   " << num_edges << std::endl;
   std::cout << "  Input stream format: " << in_file_type << std::endl;
 
-  output->write_header(num_nodes, num_edges);
-
-  std::vector<std::vector<bool>> adj_mat(num_nodes);
-  for (node_id_t i = 0; i < num_nodes; ++i) adj_mat[i] = std::vector<bool>(num_nodes - i);
-
-  constexpr size_t buf_capacity = 1024;
-  GraphStreamUpdate buf[buf_capacity];
-  size_t true_edges = 0;
-
-  bool processing = true;
-  while (processing) {
-    size_t read = input->get_update_buffer(buf, buf_capacity);
-    size_t ignored = 0;
-    for (size_t i = 0; i < read; i++) {
-      GraphStreamUpdate upd = buf[i];
-      UpdateType type = (UpdateType) upd.type;
-      Edge e = upd.edge;
-
-      if (type == BREAKPOINT) {
-        processing = false;
-        --read; // don't output the breakpoint!
-        break;
-      }
-
-      // process the update
-      node_id_t src = std::min(e.src, e.dst);
-      node_id_t dst = std::max(e.src, e.dst);
-
-      if (src == dst) {
-        if (!silent)
-          std::cerr << "WARNING: Dropping self loop edge " << src << ", " << dst << std::endl;
-
-        ++ignored;
-        continue;
-      }
-
-      if (!silent && type != adj_mat[src][dst - src - 1]) {
-        std::cerr << "WARNING: update " << print_type(type) << " " << e.src << " " << e.dst;
-        std::cerr << " is double insert or delete before insert." << std::endl;
-      }
-
-      buf[i].type = adj_mat[src][dst - src - 1];
-      adj_mat[src][dst - src - 1] = !adj_mat[src][dst - src - 1];
-
-      // shift past ignored if necessary
-      buf[i - ignored] = buf[i];
-    }
+  if (mem_bytes > 0) {
+    size_t pos = out_file_name.find_last_of('/');
+    std::string temp_dir =
+        pos == std::string::npos ? "." : out_file_name.substr(0, std::max(pos, size_t(1)));
+    to_static_out_of_core(input, output, mem_bytes, temp_dir, silent);
+    std::cout << "Done                            " << std::endl;
+    delete input;
+    close_output(output);
+    return 0;
+  }
 
-    // copy buffer to output stream
-    if (!to_static)
-      output->write_updates(buf, read - ignored);
+  output->write_header(num_nodes, num_edges);
 
-    true_edges += read - ignored;
+  // The graph is split into a shard per worker. A static stream is written from a single shard
+  // because its edges must be output in sorted order.
+  size_t hw_threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t num_workers = to_static ? 1 : std::min(hw_threads / 4 + 1, size_t(8));
+  EdgeStateSet::Backend backend = EdgeStateSet::choose_backend(num_nodes, num_edges);
+  std::vector<EdgeStateSet> graph;
+  for (size_t w = 0; w < num_workers; w++)
+    graph.emplace_back(num_nodes, num_edges, backend, num_workers, w);
 
-    if (true_edges % (buf_capacity * 10000) == 0) {
-      std::cout << "Processed: " << true_edges << " edges           \r"; fflush(stdout);
-    }
+  // ascii input is parsed by many threads, which learn the stream index of what they parsed
+  ConversionPipeline::ReadFunc read;
+  size_t num_readers = 1;
+  edge_id_t next_first = 0;
+  if (MappedAsciiFileStream *ascii_input = dynamic_cast<MappedAsciiFileStream *>(input)) {
+    num_readers = std::max(hw_threads / 2, size_t(1));
+    read = [ascii_input](GraphStreamUpdate *upds, size_t num, edge_id_t &first) {
+      return ascii_input->get_update_buffer(upds, num, first);
+    };
+  } else {
+    read = [&](GraphStreamUpdate *upds, size_t num, edge_id_t &first) {
+      size_t ret = input->get_update_buffer(upds, num);
+      first = next_first;
+      next_first += ret;
+      return ret;
+    };
   }
 
+  ConversionPipeline pipeline(graph, num_nodes, silent, num_readers);
+  size_t true_edges = pipeline.run(read, [&](GraphStreamUpdate *upds, size_t num) {
+    if (!to_static) output->write_updates(upds, num);
+  });
+
+  constexpr size_t buf_capacity = 1024;
+  GraphStreamUpdate buf[buf_capacity];
   if (to_static) {
-    true_edges = 0; // only count edges in final graph in static stream
+    true_edges = graph[0].size(); // only count edges in final graph in static stream
     size_t buf_size = 0;
-    for (node_id_t src = 0; src < num_nodes; src++) {
-      for (node_id_t dst = 0; dst < adj_mat[src].size(); dst++) {
-        true_edges += adj_mat[src][dst];
-      }
-    }
     output->write_header(num_nodes, true_edges);
-    for (node_id_t src = 0; src < num_nodes; src++) {
-      for (node_id_t dst = 0; dst < adj_mat[src].size(); dst++) {
-        if (adj_mat[src][dst]) {
-          buf[buf_size++] = {INSERT, {src, src + dst + 1}};
-          if (buf_size >= buf_capacity) {
-            output->write_updates(buf, buf_size);
-            buf_size = 0;
-          }
-        }
+    graph[0].for_each_edge([&](Edge edge) {
+      buf[buf_size++] = {INSERT, edge};
+      if (buf_size >= buf_capacity) {
+        output->write_updates(buf, buf_size);
+        buf_size = 0;
       }
-    }
+    });
     if (buf_size > 0)
       output->write_updates(buf, buf_size);
   } else {
@@ -186,5 +537,5 @@ int main(int argc, char **argv) {
   std::cout << "Done                            " << std::endl;
 
   delete input;
-  delete output;
+  close_output(output);
 }
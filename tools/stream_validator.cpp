@@ -1,5 +1,15 @@
 #include <binary_file_stream.h>
-#include <ascii_file_stream.h>
+#include <edge_state_set.h>
+#include <external_update_sorter.h>
+#include <mapped_ascii_file_stream.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 std::string type_string(uint8_t type) {
@@ -30,16 +40,398 @@ size_t populate_buf(GraphStream *stream, GraphStreamUpdate *buf, size_t buf_capa
   return ret;
 }
 
+// An invalid update found by a worker
+struct UpdateError {
+  size_t idx;
+  GraphStreamUpdate upd;
+  std::string msg;
+};
+
+// Reads a stream in large batches on the calling thread and routes every update, tagged with its
+// index in the stream, to the worker that owns its edge. Each worker receives its updates in
+// chunks through a bounded queue, in stream order, and processes them while the stream is read
+// further, so every update is handled once and workers only wait for the updates routed to them.
+class ShardedStreamReader {
+ public:
+  // an update and its index in the stream
+  struct TaggedUpdate {
+    size_t idx;
+    GraphStreamUpdate upd;
+  };
+  // work(worker, updates, num_updates)
+  typedef std::function<void(size_t, const TaggedUpdate *, size_t)> WorkFunc;
+  // route(update) gives the worker of an update, or no_worker to drop it
+  typedef std::function<size_t(const GraphStreamUpdate &)> RouteFunc;
+  // after_batch(number of updates read so far), called once a batch is routed
+  typedef std::function<void(size_t)> BatchFunc;
+  static constexpr size_t no_worker = size_t(-1);
+
+  ShardedStreamReader(GraphStream *stream, size_t num_workers, size_t batch_size)
+      : stream(stream), num_workers(num_workers), batch_size(batch_size) {}
+
+  // process the stream until the end of stream breakpoint. Returns the number of updates read,
+  // including breakpoints.
+  size_t run(RouteFunc route, WorkFunc work, BatchFunc after_batch) {
+    // every worker has a few chunks, which are filled by the reader or queued for the worker
+    std::vector<std::vector<std::vector<TaggedUpdate>>> chunks(num_workers);
+    std::vector<std::vector<size_t>> free_chunks(num_workers);
+    std::vector<std::deque<std::pair<size_t, size_t>>> full_chunks(num_workers);  // chunk, size
+    for (size_t w = 0; w < num_workers; w++) {
+      for (size_t c = 0; c < chunks_per_worker; c++) {
+        chunks[w].emplace_back(size_t(chunk_size));
+        free_chunks[w].push_back(c);
+      }
+    }
+
+    std::mutex lock;
+    std::condition_variable chunk_full;
+    std::condition_variable chunk_free;
+    bool done = false;
+    std::exception_ptr worker_exception;
+
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < num_workers; w++) {
+      workers.emplace_back([&, w]() {
+        std::unique_lock<std::mutex> lk(lock);
+        while (true) {
+          chunk_full.wait(lk, [&]() { return !full_chunks[w].empty() || done; });
+          if (full_chunks[w].empty()) return;
+          std::pair<size_t, size_t> chunk = full_chunks[w].front();
+          full_chunks[w].pop_front();
+
+          // the queued chunk is owned by the worker, so process it without the lock
+          lk.unlock();
+          try {
+            work(w, chunks[w][chunk.first].data(), chunk.second);
+          } catch (...) {
+            lk.lock();
+            worker_exception = std::current_exception();
+            chunk_free.notify_all();
+            return;
+          }
+          lk.lock();
+          free_chunks[w].push_back(chunk.first);
+          chunk_free.notify_all();
+        }
+      });
+    }
+
+    std::vector<size_t> cur(num_workers);
+    std::vector<size_t> fill(num_workers);
+    auto acquire = [&](size_t w) {
+      std::unique_lock<std::mutex> lk(lock);
+      chunk_free.wait(lk, [&]() { return !free_chunks[w].empty() || worker_exception; });
+      if (worker_exception) std::rethrow_exception(worker_exception);
+      cur[w] = free_chunks[w].back();
+      free_chunks[w].pop_back();
+    };
+    auto submit = [&](size_t w) {
+      {
+        std::lock_guard<std::mutex> lk(lock);
+        full_chunks[w].push_back({cur[w], fill[w]});
+      }
+      chunk_full.notify_all();
+      fill[w] = 0;
+    };
+    auto stop_workers = [&]() {
+      {
+        std::lock_guard<std::mutex> lk(lock);
+        done = true;
+      }
+      chunk_full.notify_all();
+      for (auto &worker : workers) worker.join();
+    };
+
+    std::vector<GraphStreamUpdate> buf(batch_size);
+    size_t total_read = 0;
+    try {
+      for (size_t w = 0; w < num_workers; w++) acquire(w);
+      while (true) {
+        bool err = false;
+        size_t num_upds = populate_buf(stream, buf.data(), batch_size, err);
+        for (size_t e = 0; e < num_upds; e++) {
+          size_t w = route(buf[e]);
+          if (w == no_worker) continue;
+          chunks[w][cur[w]][fill[w]++] = {total_read + e, buf[e]};
+          if (fill[w] == chunk_size) {
+            submit(w);
+            acquire(w);
+          }
+        }
+        total_read += num_upds;
+        after_batch(total_read);
+        if (num_upds == 1 && buf[0].type == BREAKPOINT) break;
+      }
+      for (size_t w = 0; w < num_workers; w++)
+        if (fill[w] > 0) submit(w);
+    } catch (...) {
+      stop_workers();
+      throw;
+    }
+    stop_workers();
+    if (worker_exception) std::rethrow_exception(worker_exception);
+    return total_read;
+  }
+
+ private:
+  GraphStream *stream;
+  size_t num_workers;
+  size_t batch_size;
+
+  static constexpr size_t chunk_size = 1 << 14;
+  static constexpr size_t chunks_per_worker = 4;
+};
+
+// Holds the errors with the smallest update indices, so that errors found in any order can be
+// reported in stream order within bounded memory
+class ErrorList {
+ public:
+  ErrorList(size_t capacity) : capacity(capacity) {}
+
+  void add(UpdateError error) {
+    ++total;
+    if (heap.size() == capacity) {
+      if (error.idx >= heap.front().idx) return;
+      std::pop_heap(heap.begin(), heap.end(), idx_less);
+      heap.pop_back();
+    }
+    heap.push_back(std::move(error));
+    std::push_heap(heap.begin(), heap.end(), idx_less);
+  }
+
+  // move the errors of another list into this one
+  void merge(ErrorList &other) {
+    total += other.total - other.heap.size();
+    for (auto &error : other.heap) add(std::move(error));
+    other.heap.clear();
+    other.total = 0;
+  }
+
+  // print the errors in stream order. Returns true if there were any.
+  bool report() {
+    std::sort_heap(heap.begin(), heap.end(), idx_less);
+    for (auto &error : heap) {
+      err_edge(error.upd.edge, static_cast<UpdateType>(error.upd.type), error.idx);
+      std::cerr << "       " << error.msg << std::endl;
+    }
+    if (total > heap.size())
+      std::cerr << "ERROR: " << total - heap.size() << " further errors not shown" << std::endl;
+    heap.clear();
+    return total > 0;
+  }
+
+ private:
+  size_t capacity;
+  size_t total = 0;
+  std::vector<UpdateError> heap;  // max heap by idx
+
+  static bool idx_less(const UpdateError &a, const UpdateError &b) { return a.idx < b.idx; }
+};
+
+// Reads the sorted updates of an ExternalUpdateSorter one at a time
+class SortedCursor {
+ public:
+  SortedCursor(ExternalUpdateSorter &sorter) : sorter(sorter), buf(4096) { next(); }
+
+  bool valid() const { return pos < len; }
+  const IndexedUpdate &operator*() const { return buf[pos]; }
+  void next() {
+    if (++pos >= len) {
+      len = sorter.read(buf.data(), buf.size());
+      pos = 0;
+    }
+  }
+
+ private:
+  ExternalUpdateSorter &sorter;
+  std::vector<IndexedUpdate> buf;
+  size_t pos = 0;
+  size_t len = 0;
+};
+
+/*
+ * Validate a stream in bounded memory rather than memory that grows with the number of vertices.
+ * The updates are tagged with their stream index and sorted by (src, dst, index) with an external
+ * merge sort whose runs are placed in temp_dir. The updates to each edge are then
+ * adjacent and in stream order, so a linear scan checks that they alternate between insertions
+ * and deletions and yields the edges of the final graph in sorted order. These are compared to
+ * the cumulative file, which is sorted in the same way. With a cumulative file the budget is
+ * split between two sorters: the stream and the final edges, then the final edges and the
+ * cumulative file.
+ * Returns true if the stream and cumulative file are valid.
+ */
+bool validate_out_of_core(GraphStream *stream, std::string cumul_file, size_t mem_bytes,
+                          size_t num_threads, std::string temp_dir) {
+  node_id_t nodes = stream->vertices();
+  size_t edges = stream->edges();
+  bool has_cumul = cumul_file.size() > 0;
+  size_t sorter_mem = has_cumul ? mem_bytes / 2 : mem_bytes;
+
+  constexpr size_t batch_size = 1 << 16;
+  constexpr size_t max_reported_errors = 1 << 16;
+  ErrorList errors(max_reported_errors);
+  std::vector<GraphStreamUpdate> buf(batch_size);
+
+  ExternalUpdateSorter final_edges(temp_dir, sorter_mem, 1);
+  size_t total_checked = 0;
+  {
+    // tag and sort the valid updates, invalid edges are reported right away
+    ExternalUpdateSorter updates(temp_dir, sorter_mem, num_threads);
+    size_t batches = 0;
+    while (true) {
+      bool err = false;
+      size_t num_upds = populate_buf(stream, buf.data(), batch_size, err);
+      for (size_t e = 0; e < num_upds; e++) {
+        GraphStreamUpdate upd = buf[e];
+        Edge edge = upd.edge;
+        if (upd.type == BREAKPOINT) continue;
+
+        if (edge.src == edge.dst)
+          errors.add({total_checked + e, upd, "Cannot have equal src and dst"});
+        else if (edge.src >= nodes || edge.dst >= nodes)
+          errors.add({total_checked + e, upd, "src or dst out of bounds."});
+        else
+          updates.add(edge, static_cast<UpdateType>(upd.type), total_checked + e);
+      }
+      total_checked += num_upds;
+      if (num_upds == 1 && buf[0].type == BREAKPOINT) break;
+
+      if (++batches % 256 == 0) {
+        std::cout << total_checked << "\r"; fflush(stdout);
+      }
+    }
+    updates.finish();
+    std::cout << "Sorted " << updates.size() << " updates using " << updates.runs_on_disk()
+              << " runs on disk" << std::endl;
+
+    // the k-th update to an edge must be an insertion if k is even and a deletion if k is odd
+    size_t num_final = 0;
+    bool present = false;
+    bool has_last = false;
+    IndexedUpdate last = {};
+    for (SortedCursor cur(updates); cur.valid(); cur.next()) {
+      const IndexedUpdate &upd = *cur;
+      if (has_last && upd.same_edge(last)) {
+        present = !present;
+      } else {
+        if (present && has_cumul) final_edges.add(last.edge(), INSERT, num_final);
+        num_final += present;
+        present = true;
+      }
+      last = upd;
+      has_last = true;
+
+      UpdateType expect = present ? INSERT : DELETE;
+      if (upd.update_type() != expect) {
+        GraphStreamUpdate stream_upd = {uint8_t(upd.update_type()), upd.stream_edge()};
+        errors.add({upd.idx, stream_upd, "Incorrect type! Expect: " + type_string(expect)});
+      }
+    }
+    if (present && has_cumul) final_edges.add(last.edge(), INSERT, num_final);
+    num_final += present;
+  }  // the sorted updates are released before the cumulative file is sorted
+
+  bool err = errors.report();
+  if (total_checked - 2 != edges) { // end of stream breakpoint appears twice
+    std::cerr << "ERROR: Total number of edges found in stream does not match expected!" << std::endl;
+    std::cerr << "got: " << total_checked << " expected: " << edges << std::endl;
+    err = true;
+  }
+  std::cout << std::endl;
+
+  if (err) {
+    std::cout << "ERROR: Stream invalid!" << std::endl;
+    return false;
+  }
+  std::cout << "Stream validated!" << std::endl;
+  if (!has_cumul) return true;
+
+  // sort the cumulative file and walk it alongside the final edges of the stream
+  MappedAsciiFileStream cumul_stream(cumul_file, false);
+  if (cumul_stream.vertices() != nodes) {
+    throw StreamException("stream_validator: Number of nodes do not match stream and cumul");
+  }
+  ExternalUpdateSorter cumul(temp_dir, sorter_mem, num_threads);
+  for (size_t idx = 0;;) {
+    bool read_err = false;
+    size_t num_upds = populate_buf(&cumul_stream, buf.data(), batch_size, read_err);
+    if (num_upds == 1 && buf[0].type == BREAKPOINT) break;
+    for (size_t e = 0; e < num_upds; e++) {
+      Edge edge = buf[e].edge;
+      if (buf[e].type == BREAKPOINT) continue;
+      if (edge.src == edge.dst || edge.src >= nodes || edge.dst >= nodes)
+        throw StreamException("stream_validator: Invalid edge in cumul file!");
+      cumul.add(edge, INSERT, idx++);
+    }
+  }
+  final_edges.finish();
+  cumul.finish();
+
+  SortedCursor stream_cur(final_edges);
+  SortedCursor cumul_cur(cumul);
+  auto next_cumul = [&]() {
+    IndexedUpdate prev = *cumul_cur;
+    cumul_cur.next();
+    if (cumul_cur.valid() && (*cumul_cur).same_edge(prev))
+      throw StreamException("stream_validator: Edges must appear only once in cumul file!");
+  };
+  while (stream_cur.valid() || cumul_cur.valid()) {
+    if (cumul_cur.valid() && stream_cur.valid() && (*cumul_cur).same_edge(*stream_cur)) {
+      stream_cur.next();
+      next_cumul();
+      continue;
+    }
+
+    Edge edge;
+    if (!cumul_cur.valid() || (stream_cur.valid() && (*stream_cur).edge() < (*cumul_cur).edge())) {
+      edge = (*stream_cur).edge();
+      stream_cur.next();
+    } else {
+      edge = (*cumul_cur).edge();
+      next_cumul();
+    }
+    std::cerr << "ERROR: Cumul mismatch on edge (" << edge.src << "," << edge.dst << ")"
+              << std::endl;
+    err = true;
+  }
+
+  if (err) {
+    std::cerr << "ERROR: Resulting graph does not match cumulative file!" << std::endl;
+    return false;
+  }
+  std::cerr << "Resulting graph matches cumulative file!" << std::endl;
+  return true;
+}
+
 // Check that a stream is formatted correctly. Check that types are correct and
 // node ids are in range.
 
 int main(int argc, char **argv) {
+  size_t num_threads = 1;
+  size_t mem_bytes = 0;  // validate in memory
+  while (argc >= 5) {
+    std::string option = argv[argc - 2];
+    if (option == "--threads")
+      num_threads = std::max(1l, std::stol(argv[argc - 1]));
+    else if (option == "--mem")
+      mem_bytes = std::max(1l, std::stol(argv[argc - 1])) << 20;
+    else
+      break;
+    argc -= 2;
+  }
+
   if (argc < 3 || argc > 4) {
     std::cout << "Incorrect Number of Arguments!" << std::endl;
-    std::cout << "Arguments: stream_type stream_file [cumulative_file]" << std::endl;
+    std::cout << "Arguments: stream_type stream_file [cumulative_file] [--threads num_threads]"
+              << " [--mem megabytes]" << std::endl;
+    std::cout << "stream_type is one of 'binary', 'compact_binary', or 'ascii'" << std::endl;
+    std::cout << "num_threads is the number of threads checking updates, 1 by default"
+              << std::endl;
+    std::cout << "megabytes enables out of core validation within a memory budget, sorted runs"
+              << " are placed in the directory of stream_file" << std::endl;
     exit(EXIT_FAILURE);
   }
-  
+
   std::string stream_type = argv[1];
   std::string stream_file = argv[2];
   std::string cumul_file;
@@ -49,10 +441,13 @@ int main(int argc, char **argv) {
   GraphStream *stream;
   if (stream_type == "binary") {
     stream = new BinaryFileStream(stream_file);
+  } else if (stream_type == "compact_binary") {
+    stream = new CompactBinaryFileStream(stream_file);
   } else if (stream_type == "ascii") {
-    stream = new AsciiFileStream(stream_file);
+    stream = new MappedAsciiFileStream(stream_file);
   } else {
-    throw StreamException("stream_validator: Unknown stream_type. Should be 'binary' or 'ascii'");
+    throw StreamException(
+        "stream_validator: Unknown stream_type. Should be 'binary', 'compact_binary', or 'ascii'");
   }
 
   node_id_t nodes = stream->vertices();
@@ -61,67 +456,95 @@ int main(int argc, char **argv) {
   std::cout << "Attempting to validate stream " << argv[1] << std::endl;
   std::cout << "Number of nodes   = " << nodes << std::endl;
   std::cout << "Number of updates = " << edges << std::endl;
+  std::cout << "Number of threads = " << num_threads << std::endl;
 
-  // create an adjacency matrix
-  std::vector<std::vector<bool>> adj_mat(nodes);
-  for (node_id_t i = 0; i < nodes; i++) {
-    adj_mat[i] = std::vector<bool>(nodes - i - 1, false);
+  if (mem_bytes > 0) {
+    std::cout << "Memory budget     = " << (mem_bytes >> 20) << " MiB" << std::endl;
+    size_t pos = stream_file.find_last_of('/');
+    std::string temp_dir =
+        pos == std::string::npos ? "." : stream_file.substr(0, std::max(pos, size_t(1)));
+    bool valid = validate_out_of_core(stream, cumul_file, mem_bytes, num_threads, temp_dir);
+    delete stream;
+    if (!valid) exit(EXIT_FAILURE);
+    return 0;
   }
 
+  // the set of edges currently in the graph, split into one shard per thread
+  EdgeStateSet::Backend backend = EdgeStateSet::choose_backend(nodes, edges);
+  std::vector<EdgeStateSet> graph;
+  for (size_t t = 0; t < num_threads; t++)
+    graph.emplace_back(nodes, edges, backend, num_threads, t);
+
+  constexpr size_t batch_size = 1 << 16;
+  constexpr size_t toggle_batch = 1024;
+  constexpr size_t max_reported_errors = 1 << 16;
+  std::vector<ErrorList> errors(num_threads, ErrorList(max_reported_errors));
+
+  // invalid edges belong to no shard, the first worker reports them
+  auto route = [&](const GraphStreamUpdate &upd) {
+    Edge edge = upd.edge;
+    // we allow breakpoints in the stream and don't freak out about it
+    // if they shouldn't be there then this should be reflected in the edge count
+    if (upd.type == BREAKPOINT) return ShardedStreamReader::no_worker;
+    if (edge.src == edge.dst || edge.src >= nodes || edge.dst >= nodes) return size_t(0);
+    return graph[0].shard_of(edge);
+  };
+
   // validate the type, src, and dst of each update in the stream
   bool err = false;
-  size_t buf_capacity = 1024;
-  GraphStreamUpdate buf[buf_capacity];
-  size_t total_checked = 0;
+  auto check_updates = [&](size_t t, const ShardedStreamReader::TaggedUpdate *upds,
+                           size_t num_upds) {
+    Edge toggle_edges[toggle_batch];
+    size_t toggle_idx[toggle_batch];
+    bool was_present[toggle_batch];
+    size_t num_toggles = 0;
 
-  while (true) {
-    size_t updates = populate_buf(stream, buf, buf_capacity, err);
+    // toggle the updates and check that their types match the state of the graph
+    auto check_toggles = [&]() {
+      graph[t].toggle_and_get(toggle_edges, num_toggles, was_present);
+      for (size_t i = 0; i < num_toggles; i++) {
+        const ShardedStreamReader::TaggedUpdate &tagged = upds[toggle_idx[i]];
+        if (was_present[i] != tagged.upd.type)
+          errors[t].add({tagged.idx, tagged.upd,
+                         "Incorrect type! Expect: " + type_string(was_present[i])});
+      }
+      num_toggles = 0;
+    };
 
-    for (size_t e = 0; e < updates; e++) {
-      GraphStreamUpdate upd = buf[e];
+    for (size_t e = 0; e < num_upds; e++) {
+      GraphStreamUpdate upd = upds[e].upd;
       Edge edge = upd.edge;
-      UpdateType u = static_cast<UpdateType>(upd.type);
-
-      // we allow breakpoints in the stream and don't freak out about it
-      // if they shouldn't be there then this should be reflected in the edge count
-      if (u == BREAKPOINT) continue;
-  
       if (edge.src == edge.dst) {
-        err_edge(edge, u, total_checked + e);
-        std::cerr << "       Cannot have equal src and dst" << std::endl;
-        err = true;
+        errors[t].add({upds[e].idx, upd, "Cannot have equal src and dst"});
         continue;
       }
-      
-      node_id_t src = std::min(edge.src, edge.dst);
-      node_id_t local_dst = std::max(edge.src, edge.dst) - src - 1;
-      if (adj_mat[src][local_dst] != u) {
-        err_edge(edge, u, total_checked + e);
-        std::cerr << "       Incorrect type! Expect: " << type_string(adj_mat[src][local_dst])
-                  << std::endl;
-        err = true;
-      }
-      adj_mat[src][local_dst] = !adj_mat[src][local_dst];
-  
       if (edge.src >= nodes || edge.dst >= nodes) {
-        err_edge(edge, u, total_checked + e);
-        std::cerr << "       src or dst out of bounds." << std::endl;
-        err = true;
-      } 
+        errors[t].add({upds[e].idx, upd, "src or dst out of bounds."});
+        continue;
+      }
+
+      toggle_edges[num_toggles] = edge;
+      toggle_idx[num_toggles++] = e;
+      if (num_toggles == toggle_batch) check_toggles();
     }
-    total_checked += updates;
-    if (total_checked % (buf_capacity * 10000) == 0) {
+    check_toggles();
+  };
+
+  size_t batches = 0;
+  auto after_batch = [&](size_t total_checked) {
+    if (++batches % 256 == 0) {
       std::cout << total_checked << "\r"; fflush(stdout);
     }
+  };
 
-    if (updates == 1 && buf[0].type == BREAKPOINT) {
-      if (total_checked - 2 != edges) { // end of stream breakpoint appears twice
-        std::cerr << "ERROR: Total number of edges found in stream does not match expected!" << std::endl;
-        std::cerr << "got: " << total_checked << " expected: " << edges << std::endl;
-        err = true;
-      }
-      break;
-    }
+  ShardedStreamReader reader(stream, num_threads, batch_size);
+  size_t total_checked = reader.run(route, check_updates, after_batch);
+  for (size_t t = 1; t < num_threads; t++) errors[0].merge(errors[t]);
+  err |= errors[0].report();
+  if (total_checked - 2 != edges) { // end of stream breakpoint appears twice
+    std::cerr << "ERROR: Total number of edges found in stream does not match expected!" << std::endl;
+    std::cerr << "got: " << total_checked << " expected: " << edges << std::endl;
+    err = true;
   }
   std::cout << std::endl;
 
@@ -132,10 +555,10 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
 
-  // if we have a cumulative file. Parse it into an adjacency matrix with a AsciiFileStream and
-  // compare the two adjacency lists
+  // if we have a cumulative file. Parse it into an EdgeStateSet with a MappedAsciiFileStream
+  // and compare the two graphs
   if (argc == 4) {
-    AsciiFileStream cumul_stream(cumul_file, false);
+    MappedAsciiFileStream cumul_stream(cumul_file, false);
     node_id_t cumul_nodes = cumul_stream.vertices();
     edge_id_t cumul_edges = cumul_stream.edges();
 
@@ -143,32 +566,53 @@ int main(int argc, char **argv) {
       throw StreamException("stream_validator: Number of nodes do not match stream and cumul");
     }
 
-    // create a cumulative adjacency matrix
-    std::vector<std::vector<bool>> cumul_adj(nodes);
-    for (node_id_t i = 0; i < nodes; i++) {
-      cumul_adj[i] = std::vector<bool>(nodes - i - 1, false);
-    }
-
-    for (size_t e = 0; e < cumul_edges; e++) {
-      GraphStreamUpdate upd;
-      cumul_stream.get_update_buffer(&upd, 1);
+    // create the cumulative graph. It uses the backend of the stream graph so that both graphs
+    // assign edges to shards in the same way.
+    std::vector<EdgeStateSet> cumul_graph;
+    for (size_t t = 0; t < num_threads; t++)
+      cumul_graph.emplace_back(nodes, cumul_edges, backend, num_threads, t);
 
-      node_id_t src = std::min(upd.edge.src, upd.edge.dst);
-      node_id_t local_dst = std::max(upd.edge.src, upd.edge.dst) - src - 1;
-      if (cumul_adj[src][local_dst]) {
-        throw StreamException("stream_validator: Edges must appear only once in cumul file!");
+    std::vector<std::string> cumul_errors(num_threads);
+    auto add_cumul = [&](size_t t, const ShardedStreamReader::TaggedUpdate *upds,
+                         size_t num_upds) {
+      for (size_t e = 0; e < num_upds && cumul_errors[t].empty(); e++) {
+        Edge edge = upds[e].upd.edge;
+        if (edge.src == edge.dst || edge.src >= nodes || edge.dst >= nodes)
+          cumul_errors[t] = "Invalid edge in cumul file!";
+        else if (cumul_graph[t].toggle(edge))
+          cumul_errors[t] = "Edges must appear only once in cumul file!";
       }
-      cumul_adj[src][local_dst] = true;
+    };
+    auto no_progress = [](size_t) {};
+    ShardedStreamReader cumul_reader(&cumul_stream, num_threads, batch_size);
+    cumul_reader.run(route, add_cumul, no_progress);
+    for (auto &msg : cumul_errors) {
+      if (!msg.empty()) throw StreamException("stream_validator: " + msg);
     }
 
-    for (node_id_t s = 0; s < nodes; s++) {
-      for (node_id_t d = 0; d < adj_mat[s].size(); d++) {
-        if (adj_mat[s][d] != cumul_adj[s][d]) {
-          std::cerr << "ERROR: Cumul mismatch on edge (" << s << "," << s + d + 1 << ")"
-                    << std::endl;
-          err = true;
-        }
-      }
+    // remove the cumulative edges from the graph, what remains was not in the cumulative file.
+    // Each thread compares its own shard.
+    std::vector<std::vector<Edge>> mismatches(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+      threads.emplace_back([&, t]() {
+        cumul_graph[t].for_each_edge([&](Edge edge) {
+          if (!graph[t].toggle(edge)) mismatches[t].push_back(edge);
+        });
+        graph[t].for_each_edge([&](Edge edge) {
+          if (!cumul_graph[t].get(edge)) mismatches[t].push_back(edge);
+        });
+      });
+    }
+    for (auto &thr : threads) thr.join();
+
+    std::vector<Edge> all_mismatches;
+    for (auto &m : mismatches) all_mismatches.insert(all_mismatches.end(), m.begin(), m.end());
+    std::sort(all_mismatches.begin(), all_mismatches.end());
+    for (Edge edge : all_mismatches) {
+      std::cerr << "ERROR: Cumul mismatch on edge (" << edge.src << "," << edge.dst << ")"
+                << std::endl;
+      err = true;
     }
 
     if (!err) std::cerr << "Resulting graph matches cumulative file!" << std::endl;
@@ -181,4 +625,3 @@ int main(int argc, char **argv) {
 
   delete stream;
 }
-
@@ -2,8 +2,11 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
 #include <random>
+#include <thread>
 #include <vector>
 #include <cstdlib>
 #include <chrono>
@@ -11,7 +14,10 @@
 
 #include "ascii_file_stream.h"
 #include "binary_file_stream.h"
+#include "edge_state_set.h"
+#include "file_copy.h"
 #include "permuted_set.h"
+#include "run_threads.h"
 
 // TODO: How do preprocessed and shuffle interact
 const std::string USAGE = "\n\
@@ -23,7 +29,7 @@ not be static, but this tool can only add additional dynamic edges. To remove ex
 edges make the graph static using the 'stream_file_converter' tool.\n\
 USAGE:\n\
   Arguments: input_file output_file density[+] [--extra percent] [--preprocessed]\n\
-             [--shuffle] [--seed seed]\n\
+             [--shuffle] [--seed seed] [--mem megabytes] [--threads num_threads]\n\
     input_file:    The location of the file stream to convert. MUST be a BinaryFileStream.\n\
     output_file:   Where to place the streamified BinaryFileStream.\n\
     density:       One or more density checkpoints, the stream will move from one density\n\
@@ -41,13 +47,21 @@ USAGE:\n\
     shuffle:       [OPTIONAL] If this flag is present, perform streamifying upon shuffled input.\n\
     seed seed:     [OPTIONAL] Define the seed to random number generation. If not defined one is\n\
                    chosen randomly.\n\
+    mem megabytes: [OPTIONAL] Memory budget of the shuffle, 1024 by default. The shuffle is\n\
+                   performed out of core, so the stream may be much larger than the budget.\n\
+    threads num:   [OPTIONAL] Generate each density checkpoint in parallel intervals with this\n\
+                   many threads. The stream differs from the one generated without --threads\n\
+                   but is the same for any number of threads.\n\
 \n\
   Density + Optional Arg Examples :  Explanation\n\
     100 0 100                     :  We insert the stream, delete it back out, then reinsert.\n\
     100 --extra 400               :  Insert the stream, but also 400% random insert/delete pairs.\n\
     20 40 60 80 100 --extra 200   :  Insert 20% of the stream and 20% random insert/delete pairs.\n\
                                   :  Repeat until stream finished.\n\
-    100 --shuffle                 :  Shuffle the stream but do not perfom any streamifying.\n\
+    100 --shuffle                 :  Shuffle the stream directly into output_file and set the\n\
+                                  :  type of each update from the graph in place.\n\
+    100                           :  Copy the stream, within the kernel where supported, and\n\
+                                  :  correct the types of its updates in place.\n\
     100 --preprocessed            :  Inverts type flags. After preprocessing, stream ends empty.\n\
 \n\
   Density and optional arguments must all appear after the file arguments.\n";
@@ -77,56 +91,189 @@ std::string get_file_directory(std::string file_name) {
   return file_name.substr(0, found);
 }
 
-void copy_file(std::string src_file_name, std::string dst_file_name) {
-  std::ifstream input(src_file_name, std::ios::binary);
-  std::ofstream output(dst_file_name, std::ios::binary | std::ios::trunc);
-
-  output << input.rdbuf();
+// Scatter the updates [begin, end) of src into num_buckets buckets occupying the same range of
+// dst, by a hash of their index and the seed. Thread t scatters the t-th part of the range to
+// precomputed offsets, so every bucket holds its updates in order and the result does not depend
+// upon the number of threads. Each thread buffers buf_size updates per bucket. Returns the bounds
+// of the buckets.
+std::vector<edge_id_t> scatter_range(BinaryFileStream &src, BinaryFileStream &dst,
+                                     edge_id_t begin, edge_id_t end, size_t num_buckets,
+                                     size_t seed, size_t num_threads, size_t buf_size) {
+  constexpr size_t read_batch = 1 << 16;
+  auto bucket_of = [&](edge_id_t idx) { return hash(&idx, sizeof(idx), seed) % num_buckets; };
+  auto range_begin = [&](size_t t) {
+    return begin + edge_id_t(__uint128_t(end - begin) * t / num_threads);
+  };
+
+  // count the updates each thread places in each bucket
+  std::vector<std::vector<edge_id_t>> offsets(num_threads, std::vector<edge_id_t>(num_buckets));
+  run_threads(num_threads, [&](size_t t) {
+    for (edge_id_t idx = range_begin(t); idx < range_begin(t + 1); idx++)
+      ++offsets[t][bucket_of(idx)];
+  });
+
+  // buckets are laid out in order and each is filled by the threads in order
+  std::vector<edge_id_t> bounds(num_buckets + 1);
+  edge_id_t offset = begin;
+  for (size_t k = 0; k < num_buckets; k++) {
+    bounds[k] = offset;
+    for (size_t t = 0; t < num_threads; t++) {
+      edge_id_t count = offsets[t][k];
+      offsets[t][k] = offset;
+      offset += count;
+    }
+  }
+  bounds[num_buckets] = offset;
+
+  run_threads(num_threads, [&](size_t t) {
+    std::vector<GraphStreamUpdate> in_buf(read_batch);
+    std::vector<GraphStreamUpdate> bufs(num_buckets * buf_size);
+    std::vector<size_t> fill(num_buckets);
+    auto flush = [&](size_t k) {
+      dst.write_updates_at(&bufs[k * buf_size], fill[k], offsets[t][k]);
+      offsets[t][k] += fill[k];
+      fill[k] = 0;
+    };
+
+    for (edge_id_t idx = range_begin(t); idx < range_begin(t + 1);) {
+      size_t read = src.read_updates_at(
+          in_buf.data(), std::min(edge_id_t(read_batch), range_begin(t + 1) - idx), idx);
+      for (size_t i = 0; i < read; i++) {
+        size_t k = bucket_of(idx + i);
+        bufs[k * buf_size + fill[k]++] = in_buf[i];
+        if (fill[k] == buf_size) flush(k);
+      }
+      idx += read;
+    }
+    for (size_t k = 0; k < num_buckets; k++)
+      if (fill[k] > 0) flush(k);
+  });
+  return bounds;
 }
 
-// take a binary stream and place the shuffled version in a file of a given name
-void shuffle_stream(size_t seed, std::string temp_file_name) {
+// Shuffle a binary stream out of core and place the shuffled stream in a file of a given name.
+// The stream is scattered into buckets that each occupy a contiguous range of the shuffled file,
+// see scatter_range. A bucket too large to be shuffled in memory is scattered again into the same
+// range of a temporary file, and so on back and forth, until every bucket fits. Each bucket is
+// then shuffled in memory and written to its place in the shuffled file. Bucket sizes follow from
+// the number of updates alone, so the result only depends upon the seed.
+//
+// Half of the memory budget holds the write buffers of the scatter. A range is scattered into at
+// most max_fan_out buckets, each receiving the updates of a thread in flushes of up to
+// scatter_flush bytes, and fewer threads scatter when the budget cannot hold full buffers for all.
+void shuffle_stream(size_t seed, std::string in_file_name, std::string shuf_file_name,
+                    size_t mem_bytes, size_t num_threads) {
   std::cout << "Shuffling Stream..." << std::endl;
-  BinaryFileStream shuf_stream(temp_file_name, false);
-
-  edge_id_t num_edges = shuf_stream.edges();
-  edge_id_t buffer_size = std::min(edge_id_t(1000000), num_edges);
+  BinaryFileStream input(in_file_name, true);
+  BinaryFileStream shuf_stream(shuf_file_name, false);
 
+  edge_id_t num_edges = input.edges();
+  shuf_stream.write_header(input.vertices(), num_edges);
   std::cout << "shuffled stream edges = " << num_edges << std::endl;
+  if (num_edges == 0) return;
+
+  constexpr size_t bucket_target = 1 << 22;  // maximum updates of a bucket shuffled in memory
+  constexpr size_t max_fan_out = 256;
+  constexpr size_t scatter_flush = 1 << 20;
+  size_t scatter_mem = mem_bytes / 2;
+  size_t scatter_threads = scatter_mem / (max_fan_out * scatter_flush);
+  scatter_threads = std::max(size_t(1), std::min(num_threads, scatter_threads));
+  size_t buf_size = scatter_mem / (scatter_threads * max_fan_out * sizeof(GraphStreamUpdate));
+  buf_size = std::max(size_t(1), std::min(buf_size, scatter_flush / sizeof(GraphStreamUpdate)));
+
+  struct Bucket {
+    edge_id_t begin;
+    edge_id_t end;
+    BinaryFileStream *file;  // holding the updates of the bucket
+  };
+  std::vector<Bucket> buckets = {{0, num_edges, &input}};
+  std::string temp_file_name = shuf_file_name + ".scatter";
+  std::unique_ptr<BinaryFileStream> temp_stream;
+  for (size_t depth = 0;; depth++) {
+    std::vector<Bucket> next;
+    for (auto &bucket : buckets) {
+      edge_id_t size = bucket.end - bucket.begin;
+      if (size <= bucket_target) {
+        next.push_back(bucket);
+        continue;
+      }
+
+      // aim for buckets of half the target, so that no bucket needs another pass by chance
+      if (bucket.file == &shuf_stream && !temp_stream) {
+        std::cout << "Scattering through temporary stream file: " << temp_file_name << std::endl;
+        temp_stream.reset(new BinaryFileStream(temp_file_name, false));
+        temp_stream->write_header(input.vertices(), num_edges);
+      }
+      BinaryFileStream *dst = bucket.file == &shuf_stream ? temp_stream.get() : &shuf_stream;
+      size_t num_buckets = std::min(size_t(max_fan_out), (size - 1) / (bucket_target / 2) + 1);
+      std::vector<edge_id_t> bounds = scatter_range(*bucket.file, *dst, bucket.begin, bucket.end,
+                                                    num_buckets, seed + depth, scatter_threads,
+                                                    buf_size);
+      for (size_t k = 0; k < num_buckets; k++) next.push_back({bounds[k], bounds[k + 1], dst});
+    }
+    if (next.size() == buckets.size()) break;
+    buckets.swap(next);
+  }
 
-  GraphStreamUpdate *upd_buf1 = new GraphStreamUpdate[buffer_size];
-  GraphStreamUpdate *upd_buf2 = new GraphStreamUpdate[buffer_size];
-
-  std::mt19937_64 rand_gen(seed * 107);
-
-  // repeatedly shuffle a buffer of updates and then place them at a random offset
-  // do this twice for sufficient randomness
-  for(int r = 0; r < 2; r++) {
-    for (edge_id_t e = 0; e < num_edges; e += buffer_size) {
-      // read and shuffle updates at beginning of stream
-      shuf_stream.seek(e);
-      size_t read = shuf_stream.get_update_buffer(upd_buf1, buffer_size);
-      std::shuffle(&upd_buf1[e], &upd_buf1[e + read], rand_gen);
-
-      // choose a position where we can place the buffer
-      edge_id_t write_idx = rand_gen() % (num_edges - buffer_size + 1);
-      std::cout << "placing shuffled updates at index: " << write_idx << std::endl;
-      
-      // read contents at chosen index, and write edges there
-      shuf_stream.seek(write_idx);
-      shuf_stream.get_update_buffer(upd_buf2, read);
-      shuf_stream.seek(write_idx);
-      shuf_stream.write_updates(upd_buf1, read);
-
-      // shuffle and place copied updates
-      std::shuffle(&upd_buf2[e], &upd_buf2[e + read], rand_gen);
-      std::cout << "placing displaced updates at index: " << e << std::endl;
-      shuf_stream.seek(e);
-      shuf_stream.write_updates(upd_buf2, read);
+  // shuffle the buckets into place, as many at once as fit in the memory budget
+  size_t bucket_bytes = bucket_target * sizeof(GraphStreamUpdate) * 5 / 4;
+  size_t shuffle_threads = std::max(size_t(1), std::min(num_threads, mem_bytes / bucket_bytes));
+  std::atomic<size_t> next_bucket(0);
+  run_threads(shuffle_threads, [&](size_t) {
+    std::vector<GraphStreamUpdate> upds;
+    for (size_t k = next_bucket++; k < buckets.size(); k = next_bucket++) {
+      edge_id_t size = buckets[k].end - buckets[k].begin;
+      upds.resize(size);
+      buckets[k].file->read_updates_at(upds.data(), size, buckets[k].begin);
+      std::mt19937_64 rand_gen(hash(&k, sizeof(k), seed * 107));
+      std::shuffle(upds.begin(), upds.end(), rand_gen);
+      shuf_stream.write_updates_at(upds.data(), size, buckets[k].begin);
     }
+  });
+
+  if (temp_stream) {
+    temp_stream.reset();
+    std::remove(temp_file_name.c_str());
+  }
+}
+
+// Set the type of every update of a stream in place from the state of the graph, as a single
+// density checkpoint of 100 does, rejecting bad edges. Only batches whose types change are
+// written back, so a stream that is already valid is just read.
+void retype_stream(std::string file_name) {
+  BinaryFileStream stream(file_name, false);
+  node_id_t num_vertices = stream.vertices();
+  EdgeStateSet graph(num_vertices, stream.edges());
+
+  constexpr size_t batch_size = 1 << 16;
+  std::vector<GraphStreamUpdate> upds(batch_size);
+  std::vector<Edge> edges(batch_size);
+  std::unique_ptr<bool[]> was_present(new bool[batch_size]);
+  for (edge_id_t idx = 0; idx < stream.edges();) {
+    size_t num = stream.read_updates_at(upds.data(), batch_size, idx);
+    if (num == 0) {
+      std::cerr << "ERROR: Input stream ended during checkpoint processing!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < num; i++) {
+      Edge edge = upds[i].edge;
+      if (edge.src >= num_vertices || edge.dst >= num_vertices || edge.src == edge.dst) {
+        std::cerr << "ERROR: Bad edge encountered (" << edge.src << ", " << edge.dst << ")"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      edges[i] = edge;
+    }
+
+    graph.toggle_and_get(edges.data(), num, was_present.get());
+    bool changed = false;
+    for (size_t i = 0; i < num; i++) {
+      changed |= upds[i].type != was_present[i];
+      upds[i].type = was_present[i];
+    }
+    if (changed) stream.write_updates_at(upds.data(), num, idx);
+    idx += num;
   }
-  delete upd_buf1;
-  delete upd_buf2;
 }
 
 edge_id_t calc_streamy_edges(edge_id_t static_edges, std::vector<double> &density_checkpoints,
@@ -134,7 +281,7 @@ edge_id_t calc_streamy_edges(edge_id_t static_edges, std::vector<double> &densit
   edge_id_t stream_edges = 0;
   edge_id_t true_stream;
   if (preprocess) {
-    true_stream = (100 - density_checkpoints[0]) * static_edges;
+    true_stream = (1 - density_checkpoints[0]) * static_edges;
   } else {
     true_stream = density_checkpoints[0] * static_edges;
   }
@@ -162,7 +309,7 @@ Edge create_rand_update(node_id_t num_vertices, std::mt19937_64 &gen) {
 }
 
 void add_updates_for_checkpoint(size_t seed, BinaryFileStream *input, BinaryFileStream *output,
-                                std::vector<std::vector<bool>> &adj_mat,
+                                EdgeStateSet &graph,
                                 double current_stream_density, double goal_stream_density,
                                 double factor_adtl_updates) {
   std::cout << "DENSITY CHECKPOINT: " << current_stream_density << " -> " << goal_stream_density
@@ -236,10 +383,6 @@ void add_updates_for_checkpoint(size_t seed, BinaryFileStream *input, BinaryFile
       --extra_remove_avail;
     }
 
-    // identify the correct type of the edge and place it into the output stream
-    node_id_t src = std::min(edge.src, edge.dst);
-    node_id_t local_dst = std::max(edge.src, edge.dst) - src - 1;
-
     // perform some quick error checking
     if (edge.src >= input->vertices() || edge.dst >= input->vertices() || edge.src == edge.dst) {
       std::cerr << "ERROR: Bad edge encountered (" << edge.src << ", " << edge.dst << ")"
@@ -248,8 +391,8 @@ void add_updates_for_checkpoint(size_t seed, BinaryFileStream *input, BinaryFile
     }
 
 
-    bool present = adj_mat[src][local_dst];
-    adj_mat[src][local_dst] = !adj_mat[src][local_dst];
+    // identify the correct type of the edge and place it into the output stream
+    bool present = graph.toggle(edge);
     output_updates[output_pos++] = {present, edge};
 
     // deal with input/output stream buffering
@@ -280,6 +423,146 @@ void add_updates_for_checkpoint(size_t seed, BinaryFileStream *input, BinaryFile
   }
 }
 
+// Generate one interval of a parallel checkpoint, see add_updates_for_checkpoint_parallel. The
+// stream edges and extra insert/delete pairs are interleaved as in add_updates_for_checkpoint,
+// but the types are left to be set once the state of the graph before the interval is known.
+void generate_interval(size_t seed, BinaryFileStream *input, edge_id_t stream_begin,
+                       edge_id_t stream_edges, edge_id_t extra_pairs,
+                       std::vector<GraphStreamUpdate> &upds) {
+  std::vector<GraphStreamUpdate> stream_upds(stream_edges);
+  for (edge_id_t read = 0; read < stream_edges;) {
+    size_t r = input->read_updates_at(&stream_upds[read], stream_edges - read, stream_begin + read);
+    if (r == 0) {
+      std::cerr << "ERROR: Input stream ended during checkpoint processing!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    read += r;
+  }
+
+  std::mt19937_64 edge_gen_add(seed * 53);
+  std::mt19937_64 edge_gen_remove(seed * 53);
+  std::mt19937_64 edge_type_choice(seed * 3);
+  edge_id_t stream_remain = stream_edges;
+  edge_id_t extra_write_remain = extra_pairs;
+  edge_id_t extra_remove_avail = 0;
+  node_id_t num_vertices = input->vertices();
+
+  upds.resize(stream_edges + 2 * extra_pairs);
+  for (size_t pos = 0; pos < upds.size(); pos++) {
+    edge_id_t valid_choices = stream_remain + extra_write_remain + extra_remove_avail;
+    edge_id_t choice = edge_type_choice() % valid_choices;
+    Edge edge;
+    if (choice < stream_remain) {
+      edge = stream_upds[stream_edges - stream_remain--].edge;
+    } else if (choice < stream_remain + extra_write_remain) {
+      edge = create_rand_update(num_vertices, edge_gen_add);
+      --extra_write_remain;
+      ++extra_remove_avail;
+    } else {
+      edge = create_rand_update(num_vertices, edge_gen_remove);
+      --extra_remove_avail;
+    }
+
+    if (edge.src >= num_vertices || edge.dst >= num_vertices || edge.src == edge.dst) {
+      std::cerr << "ERROR: Bad edge encountered (" << edge.src << ", " << edge.dst << ")"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    upds[pos] = {INSERT, edge};
+  }
+}
+
+// Parallel version of add_updates_for_checkpoint. The checkpoint is split into intervals of about
+// interval_target updates. Each interval takes a contiguous part of the stream edges and an even
+// share of the extra insert/delete pairs, which it deletes again itself, and draws its choices
+// from a seed derived from the checkpoint seed and its index. Rounds of intervals are generated
+// by threads in memory, which also route the position of each update to the shard of the graph
+// owning its edge. Threads that each own a shard then set the types of their updates, and the
+// intervals are written to their offsets in the output. The output depends upon the seed but not
+// the number of threads.
+// Returns the number of updates written.
+edge_id_t add_updates_for_checkpoint_parallel(size_t seed, BinaryFileStream *input,
+                                              BinaryFileStream *output, edge_id_t output_offset,
+                                              std::vector<EdgeStateSet> &graph,
+                                              double current_stream_density,
+                                              double goal_stream_density,
+                                              double factor_adtl_updates) {
+  std::cout << "DENSITY CHECKPOINT: " << current_stream_density << " -> " << goal_stream_density
+            << std::endl;
+
+  // deleting reuses the stream edges [goal, current) in the same order as inserting them
+  edge_id_t start_edge_idx = current_stream_density * input->edges();
+  edge_id_t end_edge_idx = goal_stream_density * input->edges();
+  edge_id_t stream_begin = std::min(start_edge_idx, end_edge_idx);
+  edge_id_t stream_edges = std::max(start_edge_idx, end_edge_idx) - stream_begin;
+  edge_id_t extra_pairs = stream_edges * factor_adtl_updates;
+  edge_id_t total_edges = stream_edges + 2 * extra_pairs;
+  std::cout << "  Checkpoint edges = " << total_edges << " (stream edges = " << stream_edges
+            << " extra ins/del pairs = " << extra_pairs << ")" << std::endl;
+
+  constexpr edge_id_t interval_target = 1 << 20;
+  size_t num_intervals = (total_edges + interval_target - 1) / interval_target;
+  num_intervals = std::max(num_intervals, size_t(1));
+  auto share = [&](edge_id_t total, size_t i) {
+    return edge_id_t(__uint128_t(total) * i / num_intervals);
+  };
+
+  size_t num_threads = graph.size();
+  std::vector<std::vector<GraphStreamUpdate>> intervals(num_threads);
+  std::vector<edge_id_t> interval_offset(num_threads);
+  // routed[r][t] lists the positions in interval r of the updates to the edges of shard t
+  std::vector<std::vector<std::vector<uint32_t>>> routed(
+      num_threads, std::vector<std::vector<uint32_t>>(num_threads));
+  for (size_t first = 0; first < num_intervals; first += num_threads) {
+    size_t round = std::min(num_threads, num_intervals - first);
+    for (size_t r = 0; r < round; r++) {
+      size_t i = first + r;
+      interval_offset[r] = output_offset + share(stream_edges, i) + 2 * share(extra_pairs, i);
+    }
+
+    run_threads(round, [&](size_t r) {
+      size_t i = first + r;
+      size_t interval_seed = hash(&i, sizeof(i), seed);
+      edge_id_t begin = share(stream_edges, i);
+      generate_interval(interval_seed, input, stream_begin + begin,
+                        share(stream_edges, i + 1) - begin,
+                        share(extra_pairs, i + 1) - share(extra_pairs, i), intervals[r]);
+
+      for (auto &positions : routed[r]) positions.clear();
+      for (size_t j = 0; j < intervals[r].size(); j++)
+        routed[r][graph[0].shard_of(intervals[r][j].edge)].push_back(j);
+    });
+
+    // identify the correct types, each thread toggles the edges of its shard in stream order
+    run_threads(num_threads, [&](size_t t) {
+      constexpr size_t toggle_batch = 1024;
+      Edge edges[toggle_batch];
+      GraphStreamUpdate *toggled[toggle_batch];
+      bool was_present[toggle_batch];
+      size_t num_toggles = 0;
+      auto apply_toggles = [&]() {
+        graph[t].toggle_and_get(edges, num_toggles, was_present);
+        for (size_t j = 0; j < num_toggles; j++) toggled[j]->type = was_present[j];
+        num_toggles = 0;
+      };
+      for (size_t r = 0; r < round; r++) {
+        for (uint32_t j : routed[r][t]) {
+          GraphStreamUpdate &upd = intervals[r][j];
+          edges[num_toggles] = upd.edge;
+          toggled[num_toggles++] = &upd;
+          if (num_toggles == toggle_batch) apply_toggles();
+        }
+      }
+      apply_toggles();
+    });
+
+    run_threads(round, [&](size_t r) {
+      output->write_updates_at(intervals[r].data(), intervals[r].size(), interval_offset[r]);
+    });
+  }
+  return total_edges;
+}
+
 int main(int argc, char **argv) {
   if (argc < 4) {
     std::cerr << "ERROR: Incorrect number of arguments. Expected at least 4 but got "
@@ -296,6 +579,8 @@ int main(int argc, char **argv) {
   bool preprocessed = false;
   bool shuffle = false;
   size_t seed = generate_seed();
+  size_t mem_bytes = size_t(1024) << 20;
+  size_t num_threads = 0;  // generate checkpoints sequentially
   std::vector<double> density_checkpoints;
 
   int arg = 3;
@@ -330,12 +615,40 @@ int main(int argc, char **argv) {
       }
 
       std::string seed_str = argv[arg++];
-      seed = std::stol(seed_str);
+      seed = std::stoul(seed_str, &num_chars);
       if (num_chars != seed_str.size()) {
         std::cerr << "ERROR: Could not parse '--seed' argument: " << seed_str << std::endl;
         std::cerr << USAGE << std::endl;
         exit(EXIT_FAILURE);
       }
+    } else if (arg_str == "--threads") {
+      if (arg + 1 > argc) {
+        std::cerr << "ERROR: --threads requires the 'num_threads' argument!" << std::endl;
+        std::cerr << USAGE << std::endl;
+        exit(EXIT_FAILURE);
+      }
+
+      std::string threads_str = argv[arg++];
+      num_threads = std::stoul(threads_str, &num_chars);
+      if (num_chars != threads_str.size() || num_threads == 0) {
+        std::cerr << "ERROR: Could not parse '--threads' argument: " << threads_str << std::endl;
+        std::cerr << USAGE << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    } else if (arg_str == "--mem") {
+      if (arg + 1 > argc) {
+        std::cerr << "ERROR: --mem requires the 'megabytes' argument!" << std::endl;
+        std::cerr << USAGE << std::endl;
+        exit(EXIT_FAILURE);
+      }
+
+      std::string mem_str = argv[arg++];
+      mem_bytes = std::stoul(mem_str, &num_chars) << 20;
+      if (num_chars != mem_str.size() || mem_bytes == 0) {
+        std::cerr << "ERROR: Could not parse '--mem' argument: " << mem_str << std::endl;
+        std::cerr << USAGE << std::endl;
+        exit(EXIT_FAILURE);
+      }
     } else {
       // verify that the input is a density checkpoint (i.e. integer >= 0)
       density_checkpoints.push_back(double(std::stol(arg_str, &num_chars)) / 100);
@@ -364,6 +677,29 @@ int main(int argc, char **argv) {
     std::cout << " " << density;
   }
   std::cout << std::endl;
+  if (num_threads > 0)
+    std::cout << "Checkpoint threads:   " << num_threads << std::endl;
+
+  size_t shuffle_threads = num_threads > 0 ? num_threads
+                                           : std::max(1u, std::thread::hardware_concurrency());
+
+  // A single checkpoint of 100 without extra updates keeps the updates of the input in order and
+  // only sets their types. The input is then shuffled directly into the output, or copied without
+  // passing through user space, and the types are set in place.
+  bool pass_through = density_checkpoints.size() == 1 && density_checkpoints[0] == 1 &&
+                      extra_percent == 0 && !preprocessed;
+  if (pass_through) {
+    if (shuffle) {
+      std::cout << "Shuffling directly into the output" << std::endl;
+      shuffle_stream(seed, in_file_name, out_file_name, mem_bytes, shuffle_threads);
+    } else {
+      FileCopyMethod method = copy_file(in_file_name, out_file_name);
+      std::cout << "Copied the input with " << copy_method_string(method) << std::endl;
+    }
+    std::cout << "DENSITY CHECKPOINT: 0.00 -> 1.00, typing the output in place" << std::endl;
+    retype_stream(out_file_name);
+    return 0;
+  }
 
   BinaryFileStream *input = new BinaryFileStream(in_file_name, true);
   BinaryFileStream *output = new BinaryFileStream(out_file_name, false);
@@ -374,12 +710,7 @@ int main(int argc, char **argv) {
 
   if (shuffle) {
     std::cout << "Shuffling in temporary stream file: " << temp_file_name << std::endl;
-    std::cout << "Copy stream..." << std::endl;
-    // copy the input stream to the temporary file
-    copy_file(in_file_name, temp_file_name);
-
-    // shuffle the stream
-    shuffle_stream(seed, temp_file_name);
+    shuffle_stream(seed, in_file_name, temp_file_name, mem_bytes, shuffle_threads);
 
     // set input stream to the generated temporary file
     delete input;
@@ -393,18 +724,25 @@ int main(int argc, char **argv) {
   // write the header to the output stream
   output->write_header(input->vertices(), streamy_edges);
 
-  // create an adjacency matrix for storing the state of the graph
-  std::vector<std::vector<bool>> adj_mat(input->vertices());
-  for (node_id_t i = 0; i < input->vertices(); i++) {
-    adj_mat[i] = std::vector<bool>(input->vertices() - i - 1, false);
-  }
+  // create an edge set for storing the state of the graph, with a shard per thread
+  size_t num_shards = std::max(num_threads, size_t(1));
+  EdgeStateSet::Backend backend = EdgeStateSet::choose_backend(input->vertices(), streamy_edges);
+  std::vector<EdgeStateSet> graph;
+  for (size_t t = 0; t < num_shards; t++)
+    graph.emplace_back(input->vertices(), streamy_edges, backend, num_shards, t);
 
   // streamify updates and place in the output stream
-  add_updates_for_checkpoint(seed, input, output, adj_mat, preprocessed ? 100 : 0,
-                             density_checkpoints[0], extra_percent);
-  for (size_t d = 1; d < density_checkpoints.size(); d++) {
-    add_updates_for_checkpoint(seed * (d+1), input, output, adj_mat, density_checkpoints[d - 1],
-                               density_checkpoints[d], extra_percent);
+  edge_id_t output_offset = 0;
+  for (size_t d = 0; d < density_checkpoints.size(); d++) {
+    double current_density = d == 0 ? (preprocessed ? 1 : 0) : density_checkpoints[d - 1];
+    if (num_threads > 0) {
+      output_offset += add_updates_for_checkpoint_parallel(
+          seed * (d + 1), input, output, output_offset, graph, current_density,
+          density_checkpoints[d], extra_percent);
+    } else {
+      add_updates_for_checkpoint(seed * (d + 1), input, output, graph[0], current_density,
+                                 density_checkpoints[d], extra_percent);
+    }
   }
 
   if (shuffle) {